@@ -7,17 +7,23 @@
 /*
  * [Requirements / Limitations]
  *   Partition/Block info
- *     - Block Size: 512 bytes
- *     - Partition Size: 8,388,608 bytes (16,384 blocks)
+ *     - Block Size: 512 bytes by default, 512 to 65536 when formatted with
+ *       bv_init_opts - kept in the superblock with the other geometry
+ *     - Partition Size: 8,388,608 bytes (16,384 blocks) by default, at most
+ *       2^30 blocks - block numbers are 32 bit and partition offsets 64 bit
  *
  *   Directory Structure:
- *     - All files exist in a single root directory
- *     - No subdirectories -- just names files
+ *     - A root directory with subdirectories, paths separated by '/'
+ *     - Each directory is a B+tree of its names, one node per block
  *
  *   File Limitations
- *     - File Size: Maximum of 65,536 bytes (128 blocks)
- *     - File Names: Maximum of 32 characters including the null-byte
- *     - 256 file maximum -- Do not support more
+ *     - File Size: Limited by free space and 2 GiB, stored in at most 72 extents
+ *     - File Names: Maximum of 32 characters including the null-byte, for
+ *       each name in a path
+ *     - 256 iNodes at format, one per file or directory - the table grows a
+ *       chunk of blocks at a time from free space as they run out. The iNode
+ *       map is sized at format for a chunk per 64 blocks of the partition
+ *       (16,640 iNodes at the default size), and at most 2^24 iNodes
  *
  *   Additional Notes
  *     - Create the partition file (on disk) when bv_init is called if the file
@@ -33,607 +39,4840 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <string.h>
-//fileDescriptor struct
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <limits.h>
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define BVFS_URING 1
+//linux/fs.h (pulled in above) has its own BLOCK_SIZE
+#undef BLOCK_SIZE
+#endif
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+//fileDescriptor struct - one per bv_open, several can share an iNode
 struct fdTable{
   int cursor;
   int mode;
   int isOpen;
+  int inode;
+  //readahead - where a sequential read would start next, the window in blocks
+  //(0 when reads aren't sequential), and the file block prefetched up to
+  int raNext;
+  int raWindow;
+  int raEnd;
+  //write-behind - small writes collect here (STAGE_SIZE bytes, NULL until the first one)
+  //and end just before cursor
+  char *stage;
+  int stageLen;
+  //cache entries pinned by bv_read_view until bv_release_view (NULL until the first view)
+  int *viewPins;
+  int numViewPins;
+  //an inline file's bytes copied out for a view (INLINE_DATA bytes, NULL until the first),
+  //and whether a view still points into them
+  char *viewCopy;
+  int viewCopied;
 
 } typedef fdTable;
 
 //Structs
+//a run of contiguous blocks belonging to a file
+struct extent{
+  int start;
+  int length;
+}typedef extent;
+
+//packed INODE_SIZE bytes apiece, several to a block - names live in the directories
 struct iNode{
-  char name[32];
   int numBytes;
   int numBlocks;
   time_t time;
-  //File can only be 128 blocks long
-  short blockAddresses[128];
+  //first 8 extents live in the iNode - the rest go in extentBlock (0 if there isn't one)
+  int numExtents;
+  int extentBlock;
+  //1 for a directory - its blocks are the nodes of a B+tree of its entries
+  int isDir;
+  //1 while a file is small enough to keep its bytes in data instead of blocks
+  int isInline;
+  union{
+    extent extents[8];
+    //the rest of the record, for an inline file
+    char data[96];
+  };
 
 }typedef iNode;
 
+//one piece of a transfer - a contiguous range of the partition and where it goes in memory
+struct ioSeg{
+  off_t pos;
+  char *buf;
+  int len;
+}typedef ioSeg;
+
+//one block held by the buffer cache
+struct cacheEntry{
+  int block;
+  //0 while the block is still being read in
+  int valid;
+  int dirty;
+  //CLOCK reference bit
+  int ref;
+  //entries being filled or copied can't be evicted
+  int pins;
+  //next entry in the same hash bucket
+  int next;
+  char *data;
+}typedef cacheEntry;
+
+//buffer cache counters - see bv_cache_stats
+struct bvCacheStats{
+  long hits;
+  long misses;
+  long writebacks;
+  long readahead;
+}typedef bvCacheStats;
+
+//one journal record - len bytes for partition byte pos follow it, len 0 ends a commit
+//owner is the iNode whose record, extent block or directory node it is (-1 for the maps)
+struct logRecord{
+  int epoch;
+  int len;
+  long long pos;
+  int owner;
+  unsigned int sum;
+}typedef logRecord;
+
+//first block of the journal - records from any other epoch are stale
+struct journalHeader{
+  int magic;
+  int epoch;
+}typedef journalHeader;
+
+//options for bv_init_opts
+struct bvOptions{
+  int flags;
+  //blocks in the buffer cache - 0 for the default, -1 for no cache
+  int cacheBlocks;
+  //memory async requests will mostly use - registered with io_uring under BV_URING, may be NULL
+  void *ioBuffer;
+  int ioBufferSize;
+  //under BV_THREADSAFE, milliseconds between background flushes of staged writes - 0 for none
+  int flushMs;
+  //geometry when the partition is created - 0 for 512 byte blocks and 8 MiB
+  int blockSize;
+  int blockCount;
+}typedef bvOptions;
+
+//one finished async request - see bv_reap
+struct bvCompletion{
+  void *tag;
+  //bytes transferred, or -1 if the request failed
+  int result;
+}typedef bvCompletion;
+
+//a piece of a file handed out by bv_read_view - read only, valid until bv_release_view
+struct bvSpan{
+  const char *data;
+  int len;
+}typedef bvSpan;
+
+//one name as bv_stat and bv_readdir report it - blocks are the ones it holds in bvfs
+struct bvStat{
+  //the last name of its path, nul terminated
+  char name[32];
+  int size;
+  int blocks;
+  time_t mtime;
+  int isDir;
+}typedef bvStat;
+
+//where a bv_readdir listing is up to - zero it to start from the first name
+struct bvDirCursor{
+  //the last name handed out
+  char after[32];
+}typedef bvDirCursor;
+
+//an async request in flight - one SQE per segment
+struct aioReq{
+  void *tag;
+  int result;
+  //segments not completed yet
+  int pending;
+  int failed;
+  //a write - the iNode whose size waits for it (-1 once that's done, and for reads), where it ends
+  //and how long it is
+  int inode;
+  int end;
+  int count;
+}typedef aioReq;
+
+
+//one directory entry - the name zero padded so entries compare with memcmp
+//in an interior node inode is the child node holding names from this one on
+struct dirEntry{
+  char name[32];
+  int inode;
+}typedef dirEntry;
+
+//start of every directory node (one block) - DIR_FANOUT entries follow it, sorted by name
+struct dirNode{
+  int leaf;
+  int count;
+  //in the root, the first unused node - in an unused node, the next one (0 ends the list)
+  int free;
+}typedef dirNode;
+
+//in memory copy of a directory's B+tree - node n is block n of the directory
+struct dirTree{
+  char **nodes;
+  //partition block of each node
+  int *blocks;
+  //DIR_LOG/DIR_CKPT bits of each node
+  char *dirty;
+  int numNodes;
+  //nodes the directory has blocks for
+  int capNodes;
+}typedef dirTree;
+
+//everything kept in memory for one iNode - allocated SLOT_CHUNK at a time and never moved,
+//so a lock or pointer into one stays good while the table grows
+struct inodeSlot{
+  //its record - in metaArena or an iNode chunk
+  iNode *node;
+  //extents past the first 8 - NULL unless the file has an extent block
+  extent *more;
+  //descriptors open on it, and how many of those are for writing
+  int openCount;
+  int writerCount;
+  //unlinked while open - freed on its last close
+  int unlinked;
+  //async writes whose size isn't on the file yet, and the furthest one ends - see aioSettle
+  int aioWrites;
+  int aioEnd;
+  //changed since the last commit, and since the last checkpoint (only dirty blocks go home)
+  int logPending;
+  int dirty;
+  //B+tree of a directory - nodes is NULL for files
+  dirTree tree;
+  //readers share it, writers and truncates take it alone
+  pthread_rwlock_t lock;
+}typedef inodeSlot;
+
+//a directory node changed since the last commit
+struct nodeRef{
+  int dir;
+  int n;
+}typedef nodeRef;
+
+//block 0 - the geometry the partition was formatted with and where each region starts
+struct superBlock{
+  int magic;
+  int version;
+  int blockSize;
+  int blockCount;
+  int inodeCount;
+  int inodeStart;
+  int inodeMapStart;
+  int bitmapStart;
+  int journalStart;
+  int journalBlocks;
+  int dataStart;
+}typedef superBlock;
+
 
 //Constants
 //BLOCK_SIZE and FILE_NAME_SIZE are Bytes
-//PARTION_SIZE and FILE_SIZE are Blocks
-const int BLOCK_SIZE = 512;
+//PARTION_SIZE is Blocks - both come from the superblock at mount, these are the defaults
+int BLOCK_SIZE = 512;
 const int FILE_NAME_SIZE = 32;
-const int PARTION_SIZE = 16384;
-const int FILE_SIZE = 128;
-const int MAX_FILES = 256;
+int PARTION_SIZE = 16384;
+//iNodes in the table at format - one per file or directory, the root directory is iNode 0
+//more come in chunks of CHUNK_BLOCKS blocks taken from free space when these run out
+const int BASE_INODES = 256;
+const int ROOT_INODE = 0;
+const int CHUNK_BLOCKS = 16;
+//most iNodes the table can grow to, whatever the partition size
+const int MAX_TABLE_INODES = 1 << 24;
+//iNode slots are allocated this many at a time
+const int SLOT_CHUNK = 64;
+//longest path, including the null-byte
+const int MAX_PATH = 1024;
+const int SUPER_MAGIC = 0x62766673;
+//version 2 - 32 bit block numbers and 128 byte iNodes
+//version 3 - directories, no name column
+//version 4 - iNode map, journal records name their iNode
+//version 5 - inline files
+//version 6 - iNode map sized to the partition
+const int SUPER_VERSION = 6;
+//block sizes a partition can be formatted with
+const int MIN_BLOCK_SIZE = 512;
+const int MAX_BLOCK_SIZE = 65536;
+//most blocks a partition can have - block numbers are ints, byte offsets are 64 bit
+const int MAX_PARTITION_BLOCKS = 1 << 30;
+//bytes of metadata journal - at least 4 blocks, and twice the bitmap on big partitions
+const int JOURNAL_BYTES = 65536;
+//open file descriptors at once - separate from the iNodes since a file can be open many times
+const int MAX_OPEN = 1024;
+//extents kept in the iNode, in a files extent block, and in total
+//an extent block only uses its first 512 bytes whatever the block size
+const int INLINE_EXTENTS = 8;
+const int EXTENTS_PER_BLOCK = 64;
+const int MAX_EXTENTS = 72;
+//most iovecs handed to one preadv/pwritev
+const int MAX_IOV = 64;
+//blocks in the buffer cache when bv_init_opts isn't told otherwise
+const int DEFAULT_CACHE_BLOCKS = 64;
+//first readahead window once reads look sequential - it doubles up to readaheadMax
+const int RA_MIN_BLOCKS = 4;
+//write-behind buffer per write descriptor, 8 blocks - writes smaller than this are staged
+int STAGE_SIZE = 8 * 512;
+//blocks a writer keeps reserved past its end of file - the window follows the file size between these
+const int RESERVE_MIN_BLOCKS = 8;
+const int RESERVE_MAX_BLOCKS = 256;
+//submission queue size for BV_URING, and async requests that can be outstanding (unreaped)
+const int RING_ENTRIES = 256;
+const int MAX_AIO = 256;
+
+//bytes per iNode record - the struct is padded out to this on disk
+const int INODE_SIZE = 128;
+static_assert(sizeof(iNode) <= 128, "iNode record doesn't fit in INODE_SIZE");
+//biggest file kept inline - its bytes take the place of the extents
+const int INLINE_DATA = sizeof(((iNode *)0)->data);
+
+//Partition layout (in blocks) - set by setGeometry, shown for the default 512 byte blocks
+//  0         - super block
+//  1-64      - iNodes, 4 per block
+//  65-66     - iNode map, the first block of each chunk - 0 past the last one
+//  67-70     - free space bitmap, one bit per block (set bit means used)
+//  71-198    - metadata journal, a header block then log records
+//  199-16383 - file data, directory nodes and iNode chunks
+const int INODE_START = 1;
+int INODE_BLOCKS = 64;
+int INODE_MAP_START = 65;
+int INODE_MAP_BLOCKS = 2;
+int BITMAP_START = 67;
+int BITMAP_BLOCKS = 4;
+int JOURNAL_START = 71;
+int JOURNAL_BLOCKS = 128;
+int DATA_START = 199;
+int MAP_WORDS = 512;
+//iNodes, iNode map and bitmap are contiguous, so blocks 1 to JOURNAL_START-1 are read and written as one piece
+int ARENA_BLOCKS = 70;
+//iNodes in a chunk, chunks the map can hold (a chunk per 64 blocks at most), and the most iNodes there can be
+int CHUNK_INODES = 64;
+int MAP_CHUNKS = 256;
+int MAX_INODES = 16640;
+const int JOURNAL_MAGIC = 0x6276666a;
+//iNodes and directory nodes a commit logs - a commit that changed more is written home as a checkpoint instead
+const int LOG_INODES = 256;
+const int DIR_LOG_BLOCKS = 32;
+//biggest commit - LOG_INODES iNodes with full extent blocks, DIR_LOG_BLOCKS directory nodes, the iNode map and the whole bitmap
+int LOG_BATCH_MAX = 0;
+//entries in a directory node
+int DIR_FANOUT = (512 - sizeof(dirNode)) / sizeof(dirEntry);
+//directory node dirty bits - changed since the last commit, and since the last checkpoint
+const int DIR_LOG = 1;
+const int DIR_CKPT = 2;
 
 //Globals
-iNode* iNodeArray[256];
-fdTable* fdtArr[256];
+//every iNode's slot, SLOT_CHUNK to an entry - sized for MAX_INODES at mount so it never moves
+inodeSlot **slotTable = NULL;
+//iNodes in the table, the base ones and every chunk
+int numInodes = 0;
+//memory holding each chunk's records - read in at mount
+char **inodeChunks = NULL;
+//first block of each chunk - points into metaArena
+int *inodeMap = NULL;
+fdTable fdtArr[1024];
+//stack of unused file descriptors
+int freeFDs[1024];
+int numFreeFDs = 0;
+//files and directories with a name, not counting the root
 int num_files = 0;
+int num_dirs = 0;
 int pFD;
-short SUPERPTR = 257;
+//whole partition when mounted with BV_MMAP - NULL otherwise
+char *diskMap = NULL;
+
+//stack of unused iNodes - built with the lowest index on top, room for every iNode in the table
+int *freeInodes = NULL;
+int numFreeInodes = 0;
+
+//in memory copy of the iNode blocks and bitmap, cache line aligned - kept even when the partition
+//is mapped, so metadata only reaches its home blocks at a checkpoint, after the journal has it
+char *metaArena = NULL;
+
+//free space bitmap - points into metaArena
+unsigned int *freeMap = NULL;
+//range of bitmap words changed since the last commit, and since the last checkpoint
+int mapDirtyLo = 512;
+int mapDirtyHi = -1;
+int ckptMapLo = 512;
+int ckptMapHi = -1;
+//block the next free space search starts at
+int mapHint = 199;
+
+//metadata journal - iNodes and directory nodes changed since the last commit (the count goes
+//past the list when a commit has to be a checkpoint), the current epoch, and bytes of records
+//written after the header block
+int logInodes[LOG_INODES];
+int numLogInodes = 0;
+nodeRef logNodes[DIR_LOG_BLOCKS];
+int numLogNodes = 0;
+//the iNode map changed since the last commit, and since the last checkpoint
+int mapLogPending = 0;
+int mapCkptPending = 0;
+int journalEpoch = 1;
+int journalUsed = 0;
+char *logBatch = NULL;
+//group commit - commits asked for, commits finished, and whether one is being written
+long commitWanted = 0;
+long commitDone = 0;
+int committing = 0;
+
+//io_uring for async requests - ringFD is -1 when they run synchronously instead
+int ringFD = -1;
+#ifdef BVFS_URING
+char *sqMap = NULL;
+char *cqMap = NULL;
+size_t sqMapLen = 0;
+size_t cqMapLen = 0;
+unsigned int *sqHead, *sqTail, *sqMask, *sqArray;
+unsigned int *cqHead, *cqTail, *cqMask;
+struct io_uring_sqe *sqes = NULL;
+struct io_uring_cqe *cqes = NULL;
+unsigned int cqEntries = 0;
+#endif
+//SQEs filled in but not submitted, and submitted ones not completed
+unsigned int sqQueued = 0;
+unsigned int ringInflight = 0;
+//whether the partition is registered as fixed file 0, and the registered buffer (NULL if none)
+int fixedFile = 0;
+char *ioBuf = NULL;
+int ioBufLen = 0;
+//async requests - a free stack, and finished ones waiting for bv_reap in completion order
+aioReq aioReqs[MAX_AIO];
+int freeAio[MAX_AIO];
+int numFreeAio = 0;
+int aioDone[MAX_AIO];
+int aioDoneHead = 0;
+int aioDoneCount = 0;
+
+//buffer cache - cacheSize is 0 when there is no cache
+cacheEntry *cache = NULL;
+char *cacheData = NULL;
+int cacheSize = 0;
+int cacheHand = 0;
+//hash buckets from block number to the first cache entry in the chain
+int *cacheBuckets = NULL;
+int cacheMask = 0;
+//misses in a row longer than this skip the cache and go straight to disk
+int cacheBypass = 0;
+//biggest readahead window in blocks - 0 without a cache
+int readaheadMax = 0;
+bvCacheStats cacheStats;
+
+//thread safety - locks are only taken when mounted with BV_THREADSAFE
+//lock order is a stage lock, nameLock, metaLock, fdLock, an iNode lock, allocLock, cacheLock, ringLock
+//journalLock is only taken with no other lock held
+int threadSafe = 0;
+//directories, the free iNode stack, growing the iNode table and num_files - lookups share it
+pthread_rwlock_t nameLock;
+//shared by anything changing iNodes or the bitmap, taken alone to snapshot them
+pthread_rwlock_t metaLock;
+//file descriptor table and the per iNode open counts
+pthread_mutex_t fdLock;
+//free space bitmap
+pthread_mutex_t allocLock;
+//buffer cache bookkeeping - signalled when a block finishes loading
+pthread_mutex_t cacheLock;
+pthread_cond_t cacheCond;
+//group commit - signalled when a commit finishes
+pthread_mutex_t journalLock;
+pthread_cond_t journalCond;
+//the ring and the async request table
+pthread_mutex_t ringLock;
+//one per descriptor - its staged writes
+pthread_mutex_t stageLocks[1024];
+
+//background flusher - flushInterval is 0 when it isn't running
+pthread_t flusher;
+int flushInterval = 0;
+int flusherStop = 0;
+pthread_mutex_t flushLock;
+pthread_cond_t flushCond;
 
 // Prototypes
 int bv_init(const char *fs_fileName);
+int bv_init_opts(const char *fs_fileName, const bvOptions *opts);
 int bv_destroy();
 int bv_open(const char *fileName, int mode);
 int bv_close(int bvfs_FD);
 int bv_write(int bvfs_FD, const void *buf, size_t count);
 int bv_read(int bvfs_FD, void *buf, size_t count);
 int bv_unlink(const char* fileName);
+int bv_mkdir(const char *path);
+int bv_rmdir(const char *path);
 void bv_ls();
+int bv_stat(const char *path, bvStat *st);
+int bv_readdir(const char *path, bvDirCursor *cursor, bvStat *entries, int max);
+int bv_sync();
+int bv_fsync(int bvfs_FD);
+void bv_cache_stats(bvCacheStats *stats);
+int bv_read_async(int bvfs_FD, void *buf, size_t count, void *tag);
+int bv_write_async(int bvfs_FD, const void *buf, size_t count, void *tag);
+int bv_submit();
+int bv_reap(bvCompletion *done, int max, int minWait);
+int bv_read_view(int bvfs_FD, size_t count, bvSpan *spans, int maxSpans);
+int bv_release_view(int bvfs_FD);
+int bv_export(int bvfs_FD, int host_FD, size_t count);
+int bv_pread(int bvfs_FD, void *buf, size_t count, int offset);
+int bv_pwrite(int bvfs_FD, const void *buf, size_t count, int offset);
+int bv_lseek(int bvfs_FD, int offset, int whence);
+
+//functions to take and drop locks - they do nothing unless mounted with BV_THREADSAFE
+void readLock(pthread_rwlock_t *lock){
+  if(threadSafe) pthread_rwlock_rdlock(lock);
+}
+void writeLock(pthread_rwlock_t *lock){
+  if(threadSafe) pthread_rwlock_wrlock(lock);
+}
+void unlockRW(pthread_rwlock_t *lock){
+  if(threadSafe) pthread_rwlock_unlock(lock);
+}
+void lockMutex(pthread_mutex_t *lock){
+  if(threadSafe) pthread_mutex_lock(lock);
+}
+void unlockMutex(pthread_mutex_t *lock){
+  if(threadSafe) pthread_mutex_unlock(lock);
+}
+
+//function to create every lock for a BV_THREADSAFE mount
+void initLocks(){
+  pthread_rwlock_init(&nameLock, NULL);
+#ifdef __GLIBC__
+  //commits take metaLock alone - don't let a steady stream of writers starve them
+  pthread_rwlockattr_t prefer;
+  pthread_rwlockattr_init(&prefer);
+  pthread_rwlockattr_setkind_np(&prefer, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+  pthread_rwlock_init(&metaLock, &prefer);
+  pthread_rwlockattr_destroy(&prefer);
+#else
+  pthread_rwlock_init(&metaLock, NULL);
+#endif
+  pthread_mutex_init(&fdLock, NULL);
+  pthread_mutex_init(&allocLock, NULL);
+  pthread_mutex_init(&cacheLock, NULL);
+  pthread_cond_init(&cacheCond, NULL);
+  pthread_mutex_init(&journalLock, NULL);
+  pthread_cond_init(&journalCond, NULL);
+  pthread_mutex_init(&ringLock, NULL);
+  for(int i=0; i<MAX_OPEN; i++){
+    pthread_mutex_init(&stageLocks[i], NULL);
+  }
+}
+
+//function to tear the locks down again in bv_destroy
+void destroyLocks(){
+  pthread_rwlock_destroy(&nameLock);
+  pthread_rwlock_destroy(&metaLock);
+  pthread_mutex_destroy(&fdLock);
+  pthread_mutex_destroy(&allocLock);
+  pthread_mutex_destroy(&cacheLock);
+  pthread_cond_destroy(&cacheCond);
+  pthread_mutex_destroy(&journalLock);
+  pthread_cond_destroy(&journalCond);
+  pthread_mutex_destroy(&ringLock);
+  for(int i=0; i<MAX_OPEN; i++){
+    pthread_mutex_destroy(&stageLocks[i]);
+  }
+}
+
+//function to lay a partition out for blockSize byte blocks and blockCount blocks
+//every region starts on a block boundary, and the arena (iNodes, iNode map, bitmap) is contiguous
+void setGeometry(int blockSize, int blockCount){
+  BLOCK_SIZE = blockSize;
+  PARTION_SIZE = blockCount;
+  INODE_BLOCKS = (BASE_INODES * INODE_SIZE + blockSize - 1) / blockSize;
+  //the map holds a chunk per 64 blocks, as many map blocks as that takes
+  CHUNK_INODES = CHUNK_BLOCKS * blockSize / INODE_SIZE;
+  MAP_CHUNKS = blockCount / (4 * CHUNK_BLOCKS);
+  if(MAP_CHUNKS > (MAX_TABLE_INODES - BASE_INODES) / CHUNK_INODES){
+    MAP_CHUNKS = (MAX_TABLE_INODES - BASE_INODES) / CHUNK_INODES;
+  }
+  MAX_INODES = BASE_INODES + MAP_CHUNKS * CHUNK_INODES;
+  INODE_MAP_BLOCKS = (MAP_CHUNKS * (int)sizeof(int) + blockSize - 1) / blockSize;
+  if(INODE_MAP_BLOCKS < 1){
+    INODE_MAP_BLOCKS = 1;
+  }
+  INODE_MAP_START = INODE_START + INODE_BLOCKS;
+  BITMAP_START = INODE_MAP_START + INODE_MAP_BLOCKS;
+  MAP_WORDS = (blockCount + 31) / 32;
+  BITMAP_BLOCKS = (MAP_WORDS * (int)sizeof(int) + blockSize - 1) / blockSize;
+  JOURNAL_START = BITMAP_START + BITMAP_BLOCKS;
+  JOURNAL_BLOCKS = JOURNAL_BYTES / blockSize;
+  if(JOURNAL_BLOCKS < 2 * BITMAP_BLOCKS){
+    JOURNAL_BLOCKS = 2 * BITMAP_BLOCKS;
+  }
+  if(JOURNAL_BLOCKS < 4){
+    JOURNAL_BLOCKS = 4;
+  }
+  DATA_START = JOURNAL_START + JOURNAL_BLOCKS;
+  ARENA_BLOCKS = JOURNAL_START - INODE_START;
+  LOG_BATCH_MAX = LOG_INODES * (2 * sizeof(logRecord) + INODE_SIZE + EXTENTS_PER_BLOCK * sizeof(extent))
+                  + DIR_LOG_BLOCKS * (sizeof(logRecord) + blockSize) + 3 * sizeof(logRecord)
+                  + INODE_MAP_BLOCKS * blockSize + BITMAP_BLOCKS * blockSize;
+  STAGE_SIZE = 8 * blockSize;
+  DIR_FANOUT = (blockSize - sizeof(dirNode)) / sizeof(dirEntry);
+}
+
+//function to check a geometry asked for at format time - prints why and returns -1 if it won't do
+int checkGeometry(int blockSize, int blockCount){
+  if(blockSize < MIN_BLOCK_SIZE || blockSize > MAX_BLOCK_SIZE || (blockSize & (blockSize - 1)) != 0){
+    fprintf(stderr, "Block size %d isn't a power of 2 from %d to %d\n", blockSize, MIN_BLOCK_SIZE, MAX_BLOCK_SIZE);
+    return -1;
+  }
+  setGeometry(blockSize, blockCount);
+  if(blockCount <= DATA_START || blockCount > MAX_PARTITION_BLOCKS){
+    fprintf(stderr, "%d blocks won't do - need more than %d and at most %d\n", blockCount, DATA_START, MAX_PARTITION_BLOCKS);
+    return -1;
+  }
+  return 0;
+}
+
+//function to set the geometry from the superblock of an existing partition - returns -1 if it isn't one
+int readSuperBlock(int fd){
+  superBlock sb;
+  if(pread(fd, &sb, sizeof(sb), 0) != sizeof(sb)){
+    fprintf(stderr, "Unable to read the superblock\n");
+    return -1;
+  }
+  if(sb.magic == 0 || (sb.magic == SUPER_MAGIC && sb.version < SUPER_VERSION)){
+    //the layout has moved since (block numbers, iNode size, directories, iNode map, inline files,
+    //map size), so it needs reformatting
+    fprintf(stderr, "Partition was formatted by an older bvfs - copy the files off and format it again\n");
+    return -1;
+  }
+  if(sb.magic != SUPER_MAGIC || sb.version != SUPER_VERSION || sb.inodeCount != BASE_INODES){
+    fprintf(stderr, "Not a bvfs partition this version can mount\n");
+    return -1;
+  }
+  if(checkGeometry(sb.blockSize, sb.blockCount) != 0 || sb.dataStart != DATA_START || sb.journalStart != JOURNAL_START
+     || sb.inodeMapStart != INODE_MAP_START || sb.bitmapStart != BITMAP_START){
+    fprintf(stderr, "Superblock is damaged\n");
+    return -1;
+  }
+  return 0;
+}
+
+//function to read len bytes at byte pos of the partition - a memcpy when the partition is mapped
+//positional so threads never share a file offset
+int diskRead(void *buf, int len, off_t pos){
+  if(diskMap != NULL){
+    memcpy(buf, diskMap + pos, len);
+    return len;
+  }
+  return pread(pFD, buf, len, pos);
+}
+
+//function to write len bytes at byte pos of the partition - a memcpy when the partition is mapped
+int diskWrite(const void *buf, int len, off_t pos){
+  if(diskMap != NULL){
+    memcpy(diskMap + pos, buf, len);
+    return len;
+  }
+  return pwrite(pFD, buf, len, pos);
+}
+
+//function to run a list of segments against the partition
+//segments that sit next to each other on disk go out together as one preadv/pwritev
+//returns the number of bytes transferred
+int diskTransfer(ioSeg *segs, int n, int isWrite){
+  int total = 0;
+  int i = 0;
+  while(i < n){
+    struct iovec iov[MAX_IOV];
+    int cnt = 0;
+    int len = 0;
+    off_t pos = segs[i].pos;
+    //gather every segment that continues where the last one ended
+    while(i < n && cnt < MAX_IOV && segs[i].pos == pos + len){
+      iov[cnt].iov_base = segs[i].buf;
+      iov[cnt].iov_len = segs[i].len;
+      len += segs[i].len;
+      cnt++;
+      i++;
+    }
+
+    int done = 0;
+    if(diskMap != NULL){
+      for(int j=0, at=0; j<cnt; j++){
+        if(isWrite)
+          memcpy(diskMap + pos + at, iov[j].iov_base, iov[j].iov_len);
+        else
+          memcpy(iov[j].iov_base, diskMap + pos + at, iov[j].iov_len);
+        at += iov[j].iov_len;
+      }
+      done = len;
+    }else if(isWrite){
+      done = pwritev(pFD, iov, cnt, pos);
+    }else{
+      done = preadv(pFD, iov, cnt, pos);
+    }
+    if(done < 0){
+      return (total > 0) ? total : -1;
+    }
+    total += done;
+    //short transfer - don't go on past the hole
+    if(done < len){
+      break;
+    }
+  }
+  return total;
+}
+
+//function to set up the async request table
+void aioInit(){
+  numFreeAio = 0;
+  for(int i=MAX_AIO-1; i>=0; i--){
+    aioReqs[i].inode = -1;
+    aioReqs[i].pending = 0;
+    freeAio[numFreeAio++] = i;
+  }
+  aioDoneHead = 0;
+  aioDoneCount = 0;
+}
+
+//function to hand a finished request to bv_reap
+void aioFinish(int r){
+  aioDone[(aioDoneHead + aioDoneCount) % MAX_AIO] = r;
+  aioDoneCount++;
+}
+
+#ifdef BVFS_URING
+//function to hand queued SQEs to the kernel and optionally wait for completions
+int ringEnter(unsigned int toSubmit, unsigned int minComplete){
+  unsigned int flags = (minComplete > 0) ? IORING_ENTER_GETEVENTS : 0;
+  int ret;
+  do{
+    ret = syscall(__NR_io_uring_enter, ringFD, toSubmit, minComplete, flags, NULL, 0);
+  }while(ret < 0 && errno == EINTR);
+  return ret;
+}
+
+//function to set up the ring for a BV_URING mount - leaves ringFD at -1 if the
+//kernel won't give us one, so async requests fall back to the synchronous path
+void ringInit(void *buf, int bufLen){
+  struct io_uring_params p;
+  bzero(&p, sizeof(p));
+  ringFD = syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+  if(ringFD < 0){
+    ringFD = -1;
+    return;
+  }
+  cqEntries = p.cq_entries;
+
+  //the submission and completion rings, and the SQE array
+  sqMapLen = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  cqMapLen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if(p.features & IORING_FEAT_SINGLE_MMAP){
+    if(cqMapLen > sqMapLen) sqMapLen = cqMapLen;
+    cqMapLen = sqMapLen;
+  }
+  sqMap = (char *)mmap(NULL, sqMapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFD, IORING_OFF_SQ_RING);
+  if(sqMap == MAP_FAILED){
+    close(ringFD);
+    ringFD = -1;
+    return;
+  }
+  cqMap = sqMap;
+  if(!(p.features & IORING_FEAT_SINGLE_MMAP)){
+    cqMap = (char *)mmap(NULL, cqMapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFD, IORING_OFF_CQ_RING);
+  }
+  sqes = (struct io_uring_sqe *)mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                                     MAP_SHARED | MAP_POPULATE, ringFD, IORING_OFF_SQES);
+  if(cqMap == MAP_FAILED || sqes == MAP_FAILED){
+    if(cqMap != MAP_FAILED && cqMap != sqMap) munmap(cqMap, cqMapLen);
+    munmap(sqMap, sqMapLen);
+    close(ringFD);
+    ringFD = -1;
+    return;
+  }
+  sqHead = (unsigned int *)(sqMap + p.sq_off.head);
+  sqTail = (unsigned int *)(sqMap + p.sq_off.tail);
+  sqMask = (unsigned int *)(sqMap + p.sq_off.ring_mask);
+  sqArray = (unsigned int *)(sqMap + p.sq_off.array);
+  cqHead = (unsigned int *)(cqMap + p.cq_off.head);
+  cqTail = (unsigned int *)(cqMap + p.cq_off.tail);
+  cqMask = (unsigned int *)(cqMap + p.cq_off.ring_mask);
+  cqes = (struct io_uring_cqe *)(cqMap + p.cq_off.cqes);
+  sqQueued = 0;
+  ringInflight = 0;
+
+  //the partition is always fixed file 0
+  fixedFile = (syscall(__NR_io_uring_register, ringFD, IORING_REGISTER_FILES, &pFD, 1) == 0);
+
+  //requests whose buffer sits inside the caller's I/O buffer use the fixed read/write ops
+  ioBuf = NULL;
+  ioBufLen = 0;
+  if(buf != NULL && bufLen > 0){
+    struct iovec iov = {buf, (size_t)bufLen};
+    if(syscall(__NR_io_uring_register, ringFD, IORING_REGISTER_BUFFERS, &iov, 1) == 0){
+      ioBuf = (char *)buf;
+      ioBufLen = bufLen;
+    }
+  }
+}
+
+//function to tear the ring down - whatever is still in flight is waited for first
+void ringFree(){
+  if(ringFD == -1){
+    return;
+  }
+  if(sqQueued > 0){
+    ringEnter(sqQueued, 0);
+  }
+  while(ringInflight > 0 && ringEnter(0, ringInflight) >= 0){
+    ringInflight -= *cqTail - *cqHead;
+    __atomic_store_n(cqHead, *cqTail, __ATOMIC_RELEASE);
+  }
+  munmap(sqes, RING_ENTRIES * sizeof(struct io_uring_sqe));
+  if(cqMap != sqMap) munmap(cqMap, cqMapLen);
+  munmap(sqMap, sqMapLen);
+  close(ringFD);
+  ringFD = -1;
+}
+
+//function to submit every SQE filled in so far with one io_uring_enter
+//caller holds ringLock
+int ringSubmit(){
+  if(sqQueued == 0){
+    return 0;
+  }
+  int done = ringEnter(sqQueued, 0);
+  if(done > 0){
+    sqQueued -= done;
+    ringInflight += done;
+  }
+  return done;
+}
+
+//function to collect completions, waiting for at least one if wait is set
+//a request is finished once the last of its segments completes. caller holds ringLock
+void ringHarvest(int wait){
+  unsigned int head = *cqHead;
+  if(wait && head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE) && ringInflight > 0){
+    ringEnter(0, 1);
+  }
+  unsigned int tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+  for(; head != tail; head++){
+    struct io_uring_cqe *cqe = &cqes[head & *cqMask];
+    aioReq *req = &aioReqs[cqe->user_data];
+    if(cqe->res < 0){
+      req->failed = 1;
+    }else{
+      req->result += cqe->res;
+    }
+    ringInflight--;
+    if(--req->pending == 0){
+      aioFinish(cqe->user_data);
+    }
+  }
+  __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+}
+
+//function to fill in one SQE for a segment of request r - the ring is drained a
+//little first if it (or the completion queue behind it) is full. caller holds ringLock
+void ringQueue(int r, ioSeg *seg, int isWrite){
+  if(sqQueued == RING_ENTRIES){
+    ringSubmit();
+  }
+  while(ringInflight + sqQueued >= cqEntries){
+    ringSubmit();
+    ringHarvest(1);
+  }
+  unsigned int tail = *sqTail;
+  unsigned int idx = tail & *sqMask;
+  struct io_uring_sqe *sqe = &sqes[idx];
+  bzero(sqe, sizeof(*sqe));
+  int fixedBuf = (ioBuf != NULL && seg->buf >= ioBuf && seg->buf + seg->len <= ioBuf + ioBufLen);
+  if(fixedBuf){
+    sqe->opcode = isWrite ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    sqe->buf_index = 0;
+  }else{
+    sqe->opcode = isWrite ? IORING_OP_WRITE : IORING_OP_READ;
+  }
+  if(fixedFile){
+    sqe->fd = 0;
+    sqe->flags = IOSQE_FIXED_FILE;
+  }else{
+    sqe->fd = pFD;
+  }
+  sqe->off = seg->pos;
+  sqe->addr = (unsigned long)seg->buf;
+  sqe->len = seg->len;
+  sqe->user_data = r;
+  sqArray[idx] = idx;
+  __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+  sqQueued++;
+}
+#else
+//built without io_uring headers - every async request runs synchronously
+void ringInit(void *buf, int bufLen){ ringFD = -1; }
+void ringFree(){}
+int ringSubmit(){ return 0; }
+void ringHarvest(int wait){}
+void ringQueue(int r, ioSeg *seg, int isWrite){}
+#endif
+
+//function to set up the buffer cache with size blocks
+void cacheInit(int size){
+  cacheSize = size;
+  cacheHand = 0;
+  bzero(&cacheStats, sizeof(cacheStats));
+  readaheadMax = 0;
+  if(size <= 0){
+    cacheSize = 0;
+    return;
+  }
+  //readahead gets the same share of the cache as a pinned run
+  readaheadMax = size / 4;
+  if(readaheadMax > MAX_IOV){
+    readaheadMax = MAX_IOV;
+  }
+  //a run we cache is pinned all at once, so keep it well short of the whole cache
+  cacheBypass = size / 4;
+  if(cacheBypass >= MAX_IOV){
+    cacheBypass = MAX_IOV - 1;
+  }
+  if(cacheBypass < 1){
+    cacheBypass = 1;
+  }
+
+  //one slab for all the block data
+  cache = (cacheEntry *) malloc(size * sizeof(cacheEntry));
+  cacheData = (char *) malloc(size * BLOCK_SIZE);
+  for(int i=0; i<size; i++){
+    cache[i].block = -1;
+    cache[i].valid = 0;
+    cache[i].dirty = 0;
+    cache[i].ref = 0;
+    cache[i].pins = 0;
+    cache[i].next = -1;
+    cache[i].data = cacheData + (i * BLOCK_SIZE);
+  }
+
+  //twice as many buckets as entries, rounded up to a power of 2
+  int buckets = 1;
+  while(buckets < size * 2){
+    buckets *= 2;
+  }
+  cacheMask = buckets - 1;
+  cacheBuckets = (int *) malloc(buckets * sizeof(int));
+  for(int i=0; i<buckets; i++){
+    cacheBuckets[i] = -1;
+  }
+}
+
+//function to free the buffer cache - dirty blocks should be flushed first
+void cacheFree(){
+  free(cache);
+  free(cacheData);
+  free(cacheBuckets);
+  cache = NULL;
+  cacheData = NULL;
+  cacheBuckets = NULL;
+  cacheSize = 0;
+}
+
+//function to find the cache entry holding block - returns -1 on a miss
+//all the cache functions below expect cacheLock to be held
+int cacheFind(int block){
+  for(int e = cacheBuckets[block & cacheMask]; e != -1; e = cache[e].next){
+    if(cache[e].block == block){
+      return e;
+    }
+  }
+  return -1;
+}
+
+//function to take an entry out of its hash chain and leave it empty
+void cacheRemove(int e){
+  int *link = &cacheBuckets[cache[e].block & cacheMask];
+  while(*link != e){
+    link = &cache[*link].next;
+  }
+  *link = cache[e].next;
+  cache[e].next = -1;
+  cache[e].block = -1;
+  cache[e].valid = 0;
+  cache[e].dirty = 0;
+  cache[e].ref = 0;
+}
+
+//function to compare cache entries by block number for qsort
+int cacheCompare(const void *a, const void *b){
+  return cache[*(const int *)a].block - cache[*(const int *)b].block;
+}
+
+//function to write every dirty block in the cache
+//blocks go out sorted by block number so neighbours share one pwritev
+void cacheFlushLocked(){
+  if(cacheSize == 0){
+    return;
+  }
+  int *dirty = (int *) malloc(cacheSize * sizeof(int));
+  int n = 0;
+  for(int e=0; e<cacheSize; e++){
+    if(cache[e].block != -1 && cache[e].dirty){
+      dirty[n++] = e;
+    }
+  }
+  qsort(dirty, n, sizeof(int), cacheCompare);
+
+  ioSeg *segs = (ioSeg *) malloc((n > 0 ? n : 1) * sizeof(ioSeg));
+  for(int i=0; i<n; i++){
+    segs[i].pos = (off_t)cache[dirty[i]].block * BLOCK_SIZE;
+    segs[i].buf = cache[dirty[i]].data;
+    segs[i].len = BLOCK_SIZE;
+    cache[dirty[i]].dirty = 0;
+  }
+  diskTransfer(segs, n, 1);
+  cacheStats.writebacks += n;
+  free(segs);
+  free(dirty);
+}
+
+//function to flush the cache from outside - takes cacheLock itself
+void cacheFlush(){
+  lockMutex(&cacheLock);
+  cacheFlushLocked();
+  unlockMutex(&cacheLock);
+}
+
+//function to get an empty cache entry for block using CLOCK
+//a dirty victim flushes every dirty block at once rather than one at a time
+//the entry comes back not valid - returns -1 if every entry is pinned
+int cacheClaim(int block){
+  int e = -1;
+  for(int steps=0; steps < cacheSize * 2; steps++){
+    int cand = cacheHand;
+    cacheHand = (cacheHand + 1) % cacheSize;
+    if(cache[cand].pins > 0){
+      continue;
+    }
+    if(cache[cand].block != -1 && cache[cand].ref){
+      cache[cand].ref = 0;
+      continue;
+    }
+    e = cand;
+    break;
+  }
+  if(e == -1){
+    return -1;
+  }
+  if(cache[e].block != -1){
+    if(cache[e].dirty){
+      cacheFlushLocked();
+    }
+    cacheRemove(e);
+  }
+
+  //put it in its hash chain
+  cache[e].block = block;
+  cache[e].valid = 0;
+  cache[e].ref = 1;
+  cache[e].next = cacheBuckets[block & cacheMask];
+  cacheBuckets[block & cacheMask] = e;
+  return e;
+}
+
+//function to read claimed entries in from disk
+//the entries are pinned and not valid yet, so cacheLock is dropped while the read runs
+//entries for neighbouring blocks are read with one preadv
+void cacheFill(int *ents, int n){
+  ioSeg segs[MAX_IOV];
+  for(int i=0; i<n; i++){
+    segs[i].pos = (off_t)cache[ents[i]].block * BLOCK_SIZE;
+    segs[i].buf = cache[ents[i]].data;
+    segs[i].len = BLOCK_SIZE;
+  }
+  unlockMutex(&cacheLock);
+  diskTransfer(segs, n, 0);
+  lockMutex(&cacheLock);
+  for(int i=0; i<n; i++){
+    cache[ents[i]].valid = 1;
+  }
+  if(threadSafe) pthread_cond_broadcast(&cacheCond);
+}
+
+//function to wait for another thread to finish reading an entry in
+void cacheWait(int e){
+  while(!cache[e].valid){
+    if(!threadSafe) return;
+    pthread_cond_wait(&cacheCond, &cacheLock);
+  }
+}
+
+//function to forget cached copies of freed blocks - dirty data for them is thrown away
+void cacheDrop(int start, int len){
+  if(cacheSize == 0){
+    return;
+  }
+  lockMutex(&cacheLock);
+  if(len > cacheSize){
+    for(int e=0; e<cacheSize; e++){
+      if(cache[e].block >= start && cache[e].block < start+len){
+        cacheRemove(e);
+      }
+    }
+  }else{
+    for(int b=start; b<start+len; b++){
+      int e = cacheFind(b);
+      if(e != -1){
+        cacheRemove(e);
+      }
+    }
+  }
+  unlockMutex(&cacheLock);
+}
+
+//function to run a list of segments through the buffer cache
+//cached blocks are copied, writes are held as dirty blocks until a flush
+//long runs of uncached blocks go straight to disk so big transfers don't wipe out the cache
+//returns the number of bytes transferred
+int cacheTransfer(ioSeg *segs, int n, int isWrite){
+  if(cacheSize == 0){
+    return diskTransfer(segs, n, isWrite);
+  }
+  int total = 0;
+  for(int i=0; i<n; i++){
+    off_t pos = segs[i].pos;
+    char *buf = segs[i].buf;
+    int len = segs[i].len;
+    while(len > 0){
+      int block = pos / BLOCK_SIZE;
+      int blockOffset = pos % BLOCK_SIZE;
+      int lastBlock = (pos + len - 1) / BLOCK_SIZE;
+
+      lockMutex(&cacheLock);
+      //count how many uncached blocks in a row start here
+      int run = 0;
+      while(block+run <= lastBlock && run <= cacheBypass && cacheFind(block+run) == -1){
+        run++;
+      }
+      if(run > cacheBypass){
+        while(block+run <= lastBlock && cacheFind(block+run) == -1){
+          run++;
+        }
+        cacheStats.misses += run;
+        unlockMutex(&cacheLock);
+
+        int bytes = (run * BLOCK_SIZE) - blockOffset;
+        if(bytes > len){
+          bytes = len;
+        }
+        ioSeg direct = {pos, buf, bytes};
+        int done = diskTransfer(&direct, 1, isWrite);
+        if(done < 0){
+          return (total > 0) ? total : -1;
+        }
+        total += done;
+        pos += done;
+        buf += done;
+        len -= done;
+        if(done < bytes){
+          return total;
+        }
+        continue;
+      }
+
+      //pin the blocks we're about to copy - uncached ones get read in together
+      //a write doesn't need to read blocks it covers completely
+      int count = (run == 0) ? 1 : run;
+      int ents[MAX_IOV];
+      //entries this write fills completely - nothing to read or wait for
+      int fresh[MAX_IOV];
+      int loads[MAX_IOV];
+      int numLoads = 0;
+      for(int k=0; k<count; k++){
+        int b = block + k;
+        int e = cacheFind(b);
+        fresh[k] = 0;
+        if(e != -1){
+          cacheStats.hits++;
+        }else{
+          e = cacheClaim(b);
+          if(e != -1){
+            cacheStats.misses++;
+            off_t from = (k == 0) ? pos : (off_t)b * BLOCK_SIZE;
+            int whole = (from % BLOCK_SIZE == 0 && pos + len >= (off_t)(b+1) * BLOCK_SIZE);
+            if(isWrite && whole){
+              fresh[k] = 1;
+            }else{
+              loads[numLoads++] = e;
+            }
+          }
+        }
+        if(e != -1){
+          cache[e].pins++;
+        }
+        ents[k] = e;
+      }
+      if(numLoads > 0){
+        cacheFill(loads, numLoads);
+      }
+      //another thread may still be reading some of these in
+      for(int k=0; k<count; k++){
+        if(ents[k] != -1 && !fresh[k]){
+          cacheWait(ents[k]);
+        }
+      }
+      unlockMutex(&cacheLock);
+
+      //copy each block in or out of its entry without holding the lock
+      int copied = 0;
+      int failed = 0;
+      for(int k=0; k<count && len>0; k++){
+        int piece = BLOCK_SIZE - (pos % BLOCK_SIZE);
+        if(piece > len){
+          piece = len;
+        }
+        int e = ents[k];
+        if(e == -1){
+          //nothing could be evicted for it - do this block without the cache
+          ioSeg direct = {pos, buf, piece};
+          if(diskTransfer(&direct, 1, isWrite) != piece){
+            failed = 1;
+            break;
+          }
+        }else if(isWrite){
+          memcpy(cache[e].data + (pos % BLOCK_SIZE), buf, piece);
+        }else{
+          memcpy(buf, cache[e].data + (pos % BLOCK_SIZE), piece);
+        }
+        copied += piece;
+        pos += piece;
+        buf += piece;
+        len -= piece;
+      }
+
+      lockMutex(&cacheLock);
+      for(int k=0; k<count; k++){
+        int e = ents[k];
+        if(e == -1){
+          continue;
+        }
+        if(isWrite){
+          cache[e].dirty = 1;
+          cache[e].valid = 1;
+        }
+        cache[e].ref = 1;
+        cache[e].pins--;
+      }
+      if(isWrite && threadSafe) pthread_cond_broadcast(&cacheCond);
+      unlockMutex(&cacheLock);
+
+      total += copied;
+      if(failed){
+        return total;
+      }
+    }
+  }
+  return total;
+}
+
+//function to get the cache out of the way of I/O that goes around it
+//dirty blocks in the segments are written back, and a write drops them as well
+//caller holds the iNode lock of the file the segments belong to
+void cacheSettle(ioSeg *segs, int n, int isWrite){
+  if(cacheSize == 0){
+    return;
+  }
+  lockMutex(&cacheLock);
+  for(int i=0; i<n; i++){
+    int last = (segs[i].pos + segs[i].len - 1) / BLOCK_SIZE;
+    for(int b = segs[i].pos / BLOCK_SIZE; b <= last; b++){
+      int e = cacheFind(b);
+      if(e == -1){
+        continue;
+      }
+      if(cache[e].dirty){
+        diskWrite(cache[e].data, BLOCK_SIZE, (off_t)b * BLOCK_SIZE);
+        cache[e].dirty = 0;
+        cacheStats.writebacks++;
+      }
+      if(isWrite){
+        cacheRemove(e);
+      }
+    }
+  }
+  unlockMutex(&cacheLock);
+}
+
+//function to get the in memory slot of iNode id
+inodeSlot* getSlot(int id){
+  return &slotTable[id / SLOT_CHUNK][id % SLOT_CHUNK];
+}
+
+//function to get the record of iNode id
+iNode* getInode(int id){
+  return getSlot(id)->node;
+}
+
+//function to find where iNode id's record is on the partition - in the base table, or in
+//its chunk from the iNode map
+off_t inodePos(int id){
+  if(id < BASE_INODES){
+    return (off_t)INODE_START * BLOCK_SIZE + id * INODE_SIZE;
+  }
+  id -= BASE_INODES;
+  return (off_t)inodeMap[id / CHUNK_INODES] * BLOCK_SIZE + (id % CHUNK_INODES) * INODE_SIZE;
+}
+
+//function to note that an iNode (or its extents) changed - the next commit logs it and the
+//next checkpoint writes its blocks home. caller holds its iNode lock and metaLock shared,
+//so other iNodes can be touched at the same time
+void touchInode(int id){
+  inodeSlot *slot = getSlot(id);
+  if(!slot->logPending){
+    slot->logPending = 1;
+    int k = __atomic_fetch_add(&numLogInodes, 1, __ATOMIC_RELAXED);
+    if(k < LOG_INODES){
+      logInodes[k] = id;
+    }
+  }
+  slot->dirty = 1;
+}
+
+//function to set or clear the bitmap bits for len blocks starting at start
+void markBlocks(int start, int len, int used){
+  for(int b=start; b<start+len; b++){
+    if(used)
+      freeMap[b/32] |= (1u << (b%32));
+    else
+      freeMap[b/32] &= ~(1u << (b%32));
+  }
+  //remember which words the next commit has to log
+  if(start/32 < mapDirtyLo) mapDirtyLo = start/32;
+  if((start+len-1)/32 > mapDirtyHi) mapDirtyHi = (start+len-1)/32;
+  if(start/32 < ckptMapLo) ckptMapLo = start/32;
+  if((start+len-1)/32 > ckptMapHi) ckptMapHi = (start+len-1)/32;
+}
+
+//function to check if a block is free in the bitmap
+int blockFree(int b){
+  return !(freeMap[b/32] & (1u << (b%32)));
+}
+
+//function to find the first free block at or after from - returns -1 if there isn't one
+int findFreeBlock(int from, int to){
+  int b = from;
+  while(b < to){
+    //skip over words that are completely used
+    if(b%32 == 0 && freeMap[b/32] == 0xFFFFFFFF){
+      b += 32;
+      continue;
+    }
+    if(blockFree(b)){
+      return b;
+    }
+    b++;
+  }
+  return -1;
+}
+
+//function to find the first run of want free blocks between from and to - returns -1 if there isn't one
+int findFreeRun(int from, int to, int want){
+  int b = findFreeBlock(from, to);
+  while(b != -1){
+    int len = 1;
+    while(len < want && b+len < to && blockFree(b+len)){
+      len++;
+    }
+    if(len == want){
+      return b;
+    }
+    b = findFreeBlock(b+len, to);
+  }
+  return -1;
+}
+
+//function to find the last free block before to and at or after from - returns -1 if there isn't one
+int findLastFreeBlock(int from, int to){
+  int b = to - 1;
+  while(b >= from){
+    //skip over words that are completely used
+    if(b%32 == 31 && freeMap[b/32] == 0xFFFFFFFF){
+      b -= 32;
+      continue;
+    }
+    if(blockFree(b)){
+      return b;
+    }
+    b--;
+  }
+  return -1;
+}
+
+//function to take a run of up to want contiguous free blocks out of the bitmap
+//starts looking at hint (usually the block after a files last block) so files stay contiguous
+//if the hint is taken the first run that fits all of want is used, then any free block
+//returns the first block of the run and sets got to its length - returns -1 if there are no blocks left
+int allocBlocks(int hint, int want, int *got){
+  lockMutex(&allocLock);
+  if(hint < DATA_START || hint >= PARTION_SIZE){
+    hint = mapHint;
+  }
+  int start = (hint < PARTION_SIZE && blockFree(hint)) ? hint : -1;
+  //search from the hint to the end then wrap around
+  if(start == -1){
+    start = findFreeRun(hint, PARTION_SIZE, want);
+  }
+  if(start == -1){
+    start = findFreeRun(DATA_START, hint, want);
+  }
+  if(start == -1){
+    start = findFreeBlock(hint, PARTION_SIZE);
+  }
+  if(start == -1){
+    start = findFreeBlock(DATA_START, hint);
+  }
+  if(start == -1){
+    unlockMutex(&allocLock);
+    *got = 0;
+    return -1;
+  }
+
+  //grow the run as far as we can
+  int len = 1;
+  while(len < want && start+len < PARTION_SIZE && blockFree(start+len)){
+    len++;
+  }
+  markBlocks(start, len, 1);
+  mapHint = start + len;
+  unlockMutex(&allocLock);
+  *got = len;
+  return start;
+}
+
+//function to put len blocks starting at start back into free space
+//cached copies go first so nobody can reuse the blocks while stale data for them is cached
+void freeBlocks(int start, int len){
+  cacheDrop(start, len);
+  lockMutex(&allocLock);
+  markBlocks(start, len, 0);
+  unlockMutex(&allocLock);
+}
+
+//function to take a block for a file's extent block - the first free one below start (where
+//the run it's needed for begins), or else the last free one on the partition, so it never
+//lands where the file's last run would grow next. returns -1 if there are no blocks left
+int allocExtentBlock(int start){
+  lockMutex(&allocLock);
+  int block = findFreeBlock(DATA_START, start);
+  if(block == -1){
+    block = findLastFreeBlock(start, PARTION_SIZE);
+  }
+  if(block != -1){
+    markBlocks(block, 1, 1);
+  }
+  unlockMutex(&allocLock);
+  return block;
+}
+
+//function to get extent i of a file
+extent* getExtent(int id, int i){
+  if(i < INLINE_EXTENTS){
+    return &(getInode(id)->extents[i]);
+  }
+  return &(getSlot(id)->more[i - INLINE_EXTENTS]);
+}
+
+//function to turn count bytes of a file starting at cursor into a list of disk segments
+//one segment per extent touched - extents that happen to be adjacent on disk are merged
+//buf can be NULL when only the disk side is wanted - segments then carry no buffer
+//returns the number of segments
+int planIO(int id, int cursor, int count, char *buf, ioSeg *segs){
+  iNode *file = getInode(id);
+  int n = 0;
+  int fileBlock = cursor / BLOCK_SIZE;
+  int blockOffset = cursor % BLOCK_SIZE;
+
+  //find the extent the cursor is in
+  int i = 0;
+  while(i < file->numExtents && fileBlock >= getExtent(id, i)->length){
+    fileBlock -= getExtent(id, i)->length;
+    i++;
+  }
+
+  while(count > 0 && i < file->numExtents){
+    extent *ext = getExtent(id, i);
+    off_t pos = ((off_t)(ext->start + fileBlock) * BLOCK_SIZE) + blockOffset;
+    int len = ((ext->length - fileBlock) * BLOCK_SIZE) - blockOffset;
+    if(len > count){
+      len = count;
+    }
+    //picks up where the last segment left off on disk and in memory
+    if(n > 0 && segs[n-1].pos + segs[n-1].len == pos && (buf == NULL || segs[n-1].buf + segs[n-1].len == buf)){
+      segs[n-1].len += len;
+    }else{
+      segs[n].pos = pos;
+      segs[n].buf = buf;
+      segs[n].len = len;
+      n++;
+    }
+    if(buf != NULL){
+      buf += len;
+    }
+    count -= len;
+    fileBlock = 0;
+    blockOffset = 0;
+    i++;
+  }
+  return n;
+}
+
+//function to put the async writes to iNode id that have finished on the file - its size grows
+//to cover each one that wrote everything, and cached copies of the blocks they wrote are
+//dropped (a read while they were in flight can have cached what was there before)
+//caller holds metaLock shared and the iNode lock for writing
+void aioApply(int id){
+  inodeSlot *slot = getSlot(id);
+  int from[MAX_AIO];
+  int len[MAX_AIO];
+  int n = 0;
+  lockMutex(&ringLock);
+  for(int r=0; r<MAX_AIO && slot->aioWrites > 0; r++){
+    aioReq *req = &aioReqs[r];
+    if(req->inode != id || req->pending > 0){
+      continue;
+    }
+    if(!req->failed && req->result == req->count && req->end > slot->node->numBytes){
+      slot->node->numBytes = req->end;
+    }
+    slot->node->time = time(NULL);
+    touchInode(id);
+    from[n] = req->end - req->count;
+    len[n] = req->count;
+    n++;
+    req->inode = -1;
+    slot->aioWrites--;
+  }
+  if(slot->aioWrites == 0){
+    slot->aioEnd = 0;
+  }
+  unlockMutex(&ringLock);
+
+  //cacheLock comes before ringLock - the iNode lock keeps readers off the blocks until they're gone
+  for(int k=0; k<n; k++){
+    ioSeg segs[MAX_EXTENTS];
+    int numSegs = planIO(id, from[k], len[k], NULL, segs);
+    for(int i=0; i<numSegs; i++){
+      int first = segs[i].pos / BLOCK_SIZE;
+      cacheDrop(first, (segs[i].pos + segs[i].len - 1) / BLOCK_SIZE - first + 1);
+    }
+  }
+}
+
+//function to wait for every async write to iNode id still in flight and put them on the file
+//anything that frees its blocks, or writes or zeroes them another way, settles it first
+//caller holds metaLock shared and the iNode lock for writing
+void aioSettle(int id){
+  if(ringFD == -1){
+    return;
+  }
+  lockMutex(&ringLock);
+  while(1){
+    int inFlight = 0;
+    for(int r=0; r<MAX_AIO && getSlot(id)->aioWrites > 0; r++){
+      if(aioReqs[r].inode == id && aioReqs[r].pending > 0){
+        inFlight = 1;
+        break;
+      }
+    }
+    if(!inFlight){
+      break;
+    }
+    ringSubmit();
+    ringHarvest(1);
+  }
+  unlockMutex(&ringLock);
+  aioApply(id);
+}
+
+//function to add a run of blocks to the end of a files block map
+//returns -1 if the file can't hold any more extents
+int addExtent(int id, int start, int len){
+  iNode *file = getInode(id);
+  //run picks up right where the last one ended - just make it longer
+  if(file->numExtents > 0){
+    extent *last = getExtent(id, file->numExtents-1);
+    if(last->start + last->length == start){
+      last->length += len;
+      file->numBlocks += len;
+      return 0;
+    }
+  }
+  if(file->numExtents == MAX_EXTENTS){
+    return -1;
+  }
+  //inline extents are full - file needs an extent block, out of the way of this run
+  if(file->numExtents == INLINE_EXTENTS){
+    int block = allocExtentBlock(start);
+    if(block == -1){
+      return -1;
+    }
+    file->extentBlock = block;
+    getSlot(id)->more = (extent *) calloc(EXTENTS_PER_BLOCK, sizeof(extent));
+  }
+  extent *next = getExtent(id, file->numExtents);
+  next->start = start;
+  next->length = len;
+  file->numExtents++;
+  file->numBlocks += len;
+  return 0;
+}
+
+//function to give a file enough blocks to hold size bytes
+//allocates right after the files last extent when it can so the file stays contiguous
+//returns how many bytes the file can hold once done (less than size if the disk fills up)
+int growFile(int id, int size){
+  iNode *file = getInode(id);
+  int needed = (size + BLOCK_SIZE - 1) / BLOCK_SIZE - file->numBlocks;
+  while(needed > 0){
+    int hint = -1;
+    if(file->numExtents > 0){
+      extent *last = getExtent(id, file->numExtents-1);
+      hint = last->start + last->length;
+    }
+    int got = 0;
+    int start = allocBlocks(hint, needed, &got);
+    if(start == -1){
+      break;
+    }
+    if(addExtent(id, start, got) == -1){
+      freeBlocks(start, got);
+      break;
+    }
+    needed -= got;
+  }
+  if(needed > 0){
+    return file->numBlocks * BLOCK_SIZE;
+  }
+  return size;
+}
+
+//function to keep blocks reserved past the end of a file being written (size bytes so far)
+//the next flush lands right after this one even if other files allocate in between
+//the window is about the file's size, and only topped up once half of it is used
+void reserveBlocks(int id, int size){
+  iNode *file = getInode(id);
+  int used = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  int window = used;
+  if(window < RESERVE_MIN_BLOCKS){
+    window = RESERVE_MIN_BLOCKS;
+  }
+  if(window > RESERVE_MAX_BLOCKS){
+    window = RESERVE_MAX_BLOCKS;
+  }
+  if(file->numBlocks - used < window / 2){
+    growFile(id, (used + window) * BLOCK_SIZE);
+  }
+}
+
+//function to give back every block past the end of a file's data - what reserveBlocks kept
+void trimFile(int id){
+  //async writes in flight are still using blocks past the end
+  aioSettle(id);
+  iNode *file = getInode(id);
+  int keep = (file->numBytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  if(file->numBlocks <= keep){
+    return;
+  }
+  while(file->numBlocks > keep){
+    extent *last = getExtent(id, file->numExtents-1);
+    int cut = file->numBlocks - keep;
+    if(cut > last->length){
+      cut = last->length;
+    }
+    freeBlocks(last->start + last->length - cut, cut);
+    last->length -= cut;
+    file->numBlocks -= cut;
+    if(last->length == 0){
+      file->numExtents--;
+    }
+  }
+  //back to inline extents only - addExtent makes a new extent block if it needs one
+  if(file->numExtents <= INLINE_EXTENTS && file->extentBlock != 0){
+    freeBlocks(file->extentBlock, 1);
+    free(getSlot(id)->more);
+    getSlot(id)->more = NULL;
+    file->extentBlock = 0;
+  }
+  touchInode(id);
+}
+
+//function to read nBlocks of a file starting at file block fromBlock into the cache ahead
+//of its reader - cached blocks are skipped and the rest go out as one preadv per disk run
+//caller holds the iNode lock
+void cacheReadahead(int id, int fromBlock, int nBlocks){
+  if(cacheSize == 0 || nBlocks <= 0){
+    return;
+  }
+  if(nBlocks > MAX_IOV){
+    nBlocks = MAX_IOV;
+  }
+  iNode *file = getInode(id);
+  int i = 0;
+  int skip = fromBlock;
+  while(i < file->numExtents && skip >= getExtent(id, i)->length){
+    skip -= getExtent(id, i)->length;
+    i++;
+  }
+
+  int loads[MAX_IOV];
+  int n = 0;
+  lockMutex(&cacheLock);
+  for(; i < file->numExtents && nBlocks > 0; i++){
+    extent *ext = getExtent(id, i);
+    for(int b = ext->start + skip; b < ext->start + ext->length && nBlocks > 0; b++, nBlocks--){
+      if(cacheFind(b) != -1){
+        continue;
+      }
+      int e = cacheClaim(b);
+      if(e == -1){
+        nBlocks = 0;
+        break;
+      }
+      cache[e].pins++;
+      loads[n++] = e;
+    }
+    skip = 0;
+  }
+  if(n > 0){
+    cacheStats.readahead += n;
+    cacheFill(loads, n);
+    for(int k=0; k<n; k++){
+      cache[loads[k]].pins--;
+    }
+  }
+  unlockMutex(&cacheLock);
+}
+
+//function to pin the cached blocks behind segs for a read view - the spans point straight
+//at the cache entries, and neighbouring entries share a span. stops early at maxSpans, at the
+//descriptors share of the cache, or when nothing can be evicted. caller holds the iNode lock
+//returns the number of spans
+int cacheView(fdTable *fdt, ioSeg *segs, int n, bvSpan *spans, int maxSpans){
+  int ents[MAX_IOV];
+  int offs[MAX_IOV];
+  int lens[MAX_IOV];
+  int loads[MAX_IOV];
+  int count = 0;
+  int numLoads = 0;
+  int room = cacheBypass - fdt->numViewPins;
+  if(room > maxSpans){
+    room = maxSpans;
+  }
+
+  lockMutex(&cacheLock);
+  for(int i=0; i<n && count<room; i++){
+    off_t pos = segs[i].pos;
+    int len = segs[i].len;
+    while(len > 0 && count < room){
+      int piece = BLOCK_SIZE - (pos % BLOCK_SIZE);
+      if(piece > len){
+        piece = len;
+      }
+      int e = cacheFind(pos / BLOCK_SIZE);
+      if(e != -1){
+        cacheStats.hits++;
+      }else{
+        e = cacheClaim(pos / BLOCK_SIZE);
+        if(e == -1){
+          break;
+        }
+        cacheStats.misses++;
+        loads[numLoads++] = e;
+      }
+      cache[e].pins++;
+      ents[count] = e;
+      offs[count] = pos % BLOCK_SIZE;
+      lens[count] = piece;
+      count++;
+      pos += piece;
+      len -= piece;
+    }
+    if(len > 0){
+      break;
+    }
+  }
+  if(numLoads > 0){
+    cacheFill(loads, numLoads);
+  }
+  for(int k=0; k<count; k++){
+    cacheWait(ents[k]);
+  }
+  unlockMutex(&cacheLock);
+
+  int numSpans = 0;
+  for(int k=0; k<count; k++){
+    const char *data = cache[ents[k]].data + offs[k];
+    if(numSpans > 0 && spans[numSpans-1].data + spans[numSpans-1].len == data){
+      spans[numSpans-1].len += lens[k];
+    }else{
+      spans[numSpans].data = data;
+      spans[numSpans].len = lens[k];
+      numSpans++;
+    }
+    fdt->viewPins[fdt->numViewPins++] = ents[k];
+  }
+  return numSpans;
+}
+
+//function to unpin every cache entry a descriptor's views hold
+void releaseViews(fdTable *fdt){
+  fdt->viewCopied = 0;
+  if(fdt->numViewPins == 0){
+    return;
+  }
+  lockMutex(&cacheLock);
+  for(int k=0; k<fdt->numViewPins; k++){
+    cache[fdt->viewPins[k]].pins--;
+  }
+  unlockMutex(&cacheLock);
+  fdt->numViewPins = 0;
+}
+
+//function to make a file empty and inline - its blocks have to be gone already
+void emptyFile(int id){
+  iNode *file = getInode(id);
+  file->numBytes = 0;
+  file->isInline = 1;
+  bzero(file->data, INLINE_DATA);
+}
+
+//function to remove blocks from an iNodes diskmap - put them back in free space
+void removeDiskMap(int id){
+  //nothing may still be writing into them
+  aioSettle(id);
+  iNode *file = getInode(id);
+  //each extent goes back as one run
+  for(int i=0; i<file->numExtents; i++){
+    extent *ext = getExtent(id, i);
+    freeBlocks(ext->start, ext->length);
+  }
+  if(file->extentBlock != 0){
+    freeBlocks(file->extentBlock, 1);
+    free(getSlot(id)->more);
+    getSlot(id)->more = NULL;
+    file->extentBlock = 0;
+  }
+  file->numExtents = 0;
+  file->numBlocks = 0;
+}
+
+//function to find which partition block holds block n of a file - -1 if it's past the end
+int fileBlockAt(int id, int n){
+  iNode *file = getInode(id);
+  for(int i=0; i<file->numExtents; i++){
+    extent *ext = getExtent(id, i);
+    if(n < ext->length){
+      return ext->start + n;
+    }
+    n -= ext->length;
+  }
+  return -1;
+}
+
+//function to get node n of a directory
+dirNode* getNode(int dir, int n){
+  return (dirNode *)getSlot(dir)->tree.nodes[n];
+}
+
+//function to get the entries that follow a node header
+dirEntry* nodeEntries(dirNode *node){
+  return (dirEntry *)(node + 1);
+}
+
+//function to find the last entry of a node whose name is at or before key (binary search)
+//returns -1 if key sorts before all of them
+int nodeSearch(dirNode *node, const char *key){
+  dirEntry *ents = nodeEntries(node);
+  int lo = 0;
+  int hi = node->count - 1;
+  int found = -1;
+  while(lo <= hi){
+    int mid = (lo + hi) / 2;
+    if(memcmp(ents[mid].name, key, FILE_NAME_SIZE) <= 0){
+      found = mid;
+      lo = mid + 1;
+    }else{
+      hi = mid - 1;
+    }
+  }
+  return found;
+}
+
+//function to find the child of an interior node that key belongs in
+//the first child also takes names before the first entry
+int nodeChild(dirNode *node, const char *key){
+  int i = nodeSearch(node, key);
+  return (i < 0) ? 0 : i;
+}
+
+//function to take entry i out of a node
+void nodeRemove(dirNode *node, int i){
+  dirEntry *ents = nodeEntries(node);
+  memmove(&ents[i], &ents[i+1], (node->count - i - 1) * sizeof(dirEntry));
+  node->count--;
+}
+
+//function to note that a directory node changed - the next commit logs it and the next
+//checkpoint writes it home. caller holds nameLock for writing
+void touchNode(int dir, int n){
+  dirTree *t = &getSlot(dir)->tree;
+  if(!(t->dirty[n] & DIR_LOG)){
+    if(numLogNodes < DIR_LOG_BLOCKS){
+      logNodes[numLogNodes].dir = dir;
+      logNodes[numLogNodes].n = n;
+    }
+    numLogNodes++;
+  }
+  t->dirty[n] |= DIR_LOG | DIR_CKPT;
+}
+
+//function to size a directory's tree for every block the directory has - new nodes get zeroed memory
+void dirFit(int dir){
+  dirTree *t = &getSlot(dir)->tree;
+  int cap = getInode(dir)->numBlocks;
+  if(cap <= t->capNodes){
+    return;
+  }
+  t->nodes = (char **) realloc(t->nodes, cap * sizeof(char *));
+  t->blocks = (int *) realloc(t->blocks, cap * sizeof(int));
+  t->dirty = (char *) realloc(t->dirty, cap);
+  for(int n=t->capNodes; n<cap; n++){
+    t->blocks[n] = fileBlockAt(dir, n);
+    t->dirty[n] = 0;
+    t->nodes[n] = (char *) calloc(1, BLOCK_SIZE);
+  }
+  t->capNodes = cap;
+}
+
+//function to bring a directory's nodes into memory at mount
+void dirLoad(int dir){
+  dirTree *t = &getSlot(dir)->tree;
+  dirFit(dir);
+  t->numNodes = getInode(dir)->numBytes / BLOCK_SIZE;
+  for(int n=0; n<t->numNodes; n++){
+    diskRead(t->nodes[n], BLOCK_SIZE, (off_t)t->blocks[n] * BLOCK_SIZE);
+  }
+}
+
+//function to let go of a directory's tree - its blocks are freed with the rest of the iNode
+void dirFree(int dir){
+  dirTree *t = &getSlot(dir)->tree;
+  for(int n=0; n<t->capNodes; n++){
+    free(t->nodes[n]);
+  }
+  free(t->nodes);
+  free(t->blocks);
+  free(t->dirty);
+  bzero(t, sizeof(dirTree));
+}
+
+//function to get an empty node for a directory - off the free list, or the next block
+//the directory doubles when it runs out of blocks, so it stays a handful of extents
+//returns -1 if the partition is full. caller holds nameLock for writing
+int newNode(int dir){
+  dirTree *t = &getSlot(dir)->tree;
+  int n;
+  if(t->numNodes > 0 && getNode(dir, 0)->free != 0){
+    n = getNode(dir, 0)->free;
+    getNode(dir, 0)->free = getNode(dir, n)->free;
+    touchNode(dir, 0);
+  }else{
+    readLock(&metaLock);
+    writeLock(&getSlot(dir)->lock);
+    iNode *file = getInode(dir);
+    if(t->numNodes == file->numBlocks){
+      growFile(dir, (file->numBlocks == 0 ? 1 : 2 * file->numBlocks) * BLOCK_SIZE);
+    }
+    if(t->numNodes == file->numBlocks){
+      unlockRW(&getSlot(dir)->lock);
+      unlockRW(&metaLock);
+      return -1;
+    }
+    dirFit(dir);
+    n = t->numNodes++;
+    file->numBytes = t->numNodes * BLOCK_SIZE;
+    touchInode(dir);
+    unlockRW(&getSlot(dir)->lock);
+    unlockRW(&metaLock);
+  }
+  bzero(t->nodes[n], BLOCK_SIZE);
+  touchNode(dir, n);
+  return n;
+}
+
+//function to put an emptied node on its directory's free list
+void freeNode(int dir, int n){
+  dirNode *node = getNode(dir, n);
+  node->leaf = 1;
+  node->count = 0;
+  node->free = getNode(dir, 0)->free;
+  getNode(dir, 0)->free = n;
+  touchNode(dir, n);
+  touchNode(dir, 0);
+}
+
+//function to find the iNode a directory has under key (zero padded) - -1 if there isn't one
+//one binary search per level. caller holds nameLock
+int dirLookup(int dir, const char *key){
+  if(getSlot(dir)->tree.numNodes == 0){
+    return -1;
+  }
+  int n = 0;
+  while(!getNode(dir, n)->leaf){
+    dirNode *node = getNode(dir, n);
+    n = nodeEntries(node)[nodeChild(node, key)].inode;
+  }
+  dirNode *leaf = getNode(dir, n);
+  int i = nodeSearch(leaf, key);
+  if(i < 0 || memcmp(nodeEntries(leaf)[i].name, key, FILE_NAME_SIZE) != 0){
+    return -1;
+  }
+  return nodeEntries(leaf)[i].inode;
+}
+
+//function to split the full child i of an interior node in two - the upper half moves to a
+//new node which goes in the parent right after it. returns -1 if the partition is full
+int splitNode(int dir, int parent, int i){
+  int c = nodeEntries(getNode(dir, parent))[i].inode;
+  int r = newNode(dir);
+  if(r == -1){
+    return -1;
+  }
+  dirNode *up = getNode(dir, parent);
+  dirNode *child = getNode(dir, c);
+  dirNode *right = getNode(dir, r);
+  int keep = child->count / 2;
+  right->leaf = child->leaf;
+  right->count = child->count - keep;
+  memcpy(nodeEntries(right), nodeEntries(child) + keep, right->count * sizeof(dirEntry));
+  child->count = keep;
+
+  //names from the right half's first one on go to it
+  dirEntry *ents = nodeEntries(up);
+  memmove(&ents[i+2], &ents[i+1], (up->count - i - 1) * sizeof(dirEntry));
+  memcpy(ents[i+1].name, nodeEntries(right)[0].name, FILE_NAME_SIZE);
+  ents[i+1].inode = r;
+  up->count++;
+  touchNode(dir, parent);
+  touchNode(dir, c);
+  return 0;
+}
+
+//function to stamp a directory changed - its iNode carries the time of the last change
+void dirChanged(int dir){
+  readLock(&metaLock);
+  writeLock(&getSlot(dir)->lock);
+  getInode(dir)->time = time(NULL);
+  touchInode(dir);
+  unlockRW(&getSlot(dir)->lock);
+  unlockRW(&metaLock);
+}
+
+//function to add key (zero padded, not already there) to a directory for iNode id
+//full nodes are split on the way down so the leaf always has room
+//returns -1 if the partition is full. caller holds nameLock for writing
+int dirInsert(int dir, const char *key, int id){
+  if(getSlot(dir)->tree.numNodes == 0){
+    if(newNode(dir) == -1){
+      return -1;
+    }
+    getNode(dir, 0)->leaf = 1;
+  }
+
+  //a full root moves down into a new node - the root always stays node 0
+  if(getNode(dir, 0)->count == DIR_FANOUT){
+    int c = newNode(dir);
+    if(c == -1){
+      return -1;
+    }
+    dirNode *root = getNode(dir, 0);
+    dirNode *child = getNode(dir, c);
+    memcpy(child, root, sizeof(dirNode) + root->count * sizeof(dirEntry));
+    child->free = 0;
+    root->leaf = 0;
+    root->count = 1;
+    bzero(nodeEntries(root)[0].name, FILE_NAME_SIZE);
+    nodeEntries(root)[0].inode = c;
+    touchNode(dir, 0);
+  }
+
+  int n = 0;
+  while(!getNode(dir, n)->leaf){
+    int i = nodeChild(getNode(dir, n), key);
+    int c = nodeEntries(getNode(dir, n))[i].inode;
+    if(getNode(dir, c)->count == DIR_FANOUT){
+      if(splitNode(dir, n, i) == -1){
+        return -1;
+      }
+      if(memcmp(key, nodeEntries(getNode(dir, n))[i+1].name, FILE_NAME_SIZE) >= 0){
+        i++;
+      }
+      c = nodeEntries(getNode(dir, n))[i].inode;
+    }
+    n = c;
+  }
+
+  dirNode *leaf = getNode(dir, n);
+  dirEntry *ents = nodeEntries(leaf);
+  int at = nodeSearch(leaf, key) + 1;
+  memmove(&ents[at+1], &ents[at], (leaf->count - at) * sizeof(dirEntry));
+  memcpy(ents[at].name, key, FILE_NAME_SIZE);
+  ents[at].inode = id;
+  leaf->count++;
+  touchNode(dir, n);
+  dirChanged(dir);
+  return 0;
+}
+
+//function to blank the first name of an interior node - its first child takes every name
+//before the second entry, so once the old first entry is gone the new one can't be trusted
+//as a lower bound (a split of the first child would put its separator out of order)
+void clearFirstName(dirNode *node){
+  if(!node->leaf && node->count > 0){
+    bzero(nodeEntries(node)[0].name, FILE_NAME_SIZE);
+  }
+}
+
+//function to take key (zero padded) out of a directory - returns -1 if it isn't there
+//a node left empty goes on the free list and out of its parent, and a root down to one
+//child takes that child's place. nodes still holding entries are never merged
+//caller holds nameLock for writing
+int dirRemove(int dir, const char *key){
+  if(getSlot(dir)->tree.numNodes == 0){
+    return -1;
+  }
+  //interior nodes on the way down and which child was taken from each
+  int path[64];
+  int slot[64];
+  int depth = 0;
+  int n = 0;
+  while(!getNode(dir, n)->leaf){
+    path[depth] = n;
+    slot[depth] = nodeChild(getNode(dir, n), key);
+    n = nodeEntries(getNode(dir, n))[slot[depth]].inode;
+    depth++;
+  }
+  dirNode *leaf = getNode(dir, n);
+  int at = nodeSearch(leaf, key);
+  if(at < 0 || memcmp(nodeEntries(leaf)[at].name, key, FILE_NAME_SIZE) != 0){
+    return -1;
+  }
+  nodeRemove(leaf, at);
+  touchNode(dir, n);
+
+  while(depth > 0 && getNode(dir, n)->count == 0){
+    freeNode(dir, n);
+    depth--;
+    n = path[depth];
+    nodeRemove(getNode(dir, n), slot[depth]);
+    clearFirstName(getNode(dir, n));
+    touchNode(dir, n);
+  }
+
+  dirNode *root = getNode(dir, 0);
+  if(!root->leaf && root->count == 0){
+    root->leaf = 1;
+  }
+  while(!root->leaf && root->count == 1){
+    int c = nodeEntries(root)[0].inode;
+    int freeList = root->free;
+    dirNode *child = getNode(dir, c);
+    memcpy(root, child, sizeof(dirNode) + child->count * sizeof(dirEntry));
+    root->free = freeList;
+    clearFirstName(root);
+    freeNode(dir, c);
+  }
+  dirChanged(dir);
+  return 0;
+}
+
+//function to check if a directory has no entries - emptied nodes don't stay in the tree,
+//so that is an empty root
+int dirEmpty(int dir){
+  return getSlot(dir)->tree.numNodes == 0 || getNode(dir, 0)->count == 0;
+}
+
+//function to find the directory a path lives in and the zero padded key of its last name
+//names are separated by '/' and are shorter than FILE_NAME_SIZE - 1 characters, every
+//name before the last has to be a directory. returns the directory's iNode, or -1 (after
+//saying why) if the path won't do. caller holds nameLock
+int resolvePath(const char *path, char *key){
+  if(strlen(path) >= MAX_PATH){
+    printf("Path to long\n");
+    return -1;
+  }
+  int dir = ROOT_INODE;
+  const char *name = path;
+  while(*name == '/'){
+    name++;
+  }
+  if(*name == '\0'){
+    printf("No file name in the path\n");
+    return -1;
+  }
+  while(1){
+    const char *end = strchr(name, '/');
+    if(end == NULL){
+      end = name + strlen(name);
+    }
+    if(end - name >= FILE_NAME_SIZE - 1){
+      printf("Filename to long\n");
+      return -1;
+    }
+    bzero(key, FILE_NAME_SIZE);
+    memcpy(key, name, end - name);
+    while(*end == '/'){
+      end++;
+    }
+    if(*end == '\0'){
+      return dir;
+    }
+    dir = dirLookup(dir, key);
+    if(dir == -1 || !getInode(dir)->isDir){
+      printf("No directory %s on the way to %s\n", key, path);
+      return -1;
+    }
+    name = end;
+  }
+}
+
+//function to mark every iNode with a name under a directory, counting files and directories
+void dirMarkNamed(int dir, char *named){
+  dirTree *t = &getSlot(dir)->tree;
+  for(int n=0; n<t->numNodes; n++){
+    dirNode *node = getNode(dir, n);
+    if(!node->leaf){
+      continue;
+    }
+    for(int i=0; i<node->count; i++){
+      int id = nodeEntries(node)[i].inode;
+      named[id] = 1;
+      if(getInode(id)->isDir){
+        num_dirs++;
+        dirMarkNamed(id, named);
+      }else{
+        num_files++;
+      }
+    }
+  }
+}
+
+//function to get the descriptor for bvfs_FD - NULL if it isn't an open file
+fdTable* getFD(int bvfs_FD){
+  if(bvfs_FD < 0 || bvfs_FD >= MAX_OPEN || fdtArr[bvfs_FD].isOpen == 0){
+    return NULL;
+  }
+  return &fdtArr[bvfs_FD];
+}
+
+//function to give an iNode back once it has no name and nobody has it open
+//caller holds nameLock for writing
+void releaseInode(int id){
+  readLock(&metaLock);
+  writeLock(&getSlot(id)->lock);
+  removeDiskMap(id);
+  if(getInode(id)->isDir){
+    dirFree(id);
+  }
+  getInode(id)->numBytes = -1;
+  getInode(id)->isDir = 0;
+  getInode(id)->isInline = 0;
+  touchInode(id);
+  unlockRW(&getSlot(id)->lock);
+  unlockRW(&metaLock);
+  getSlot(id)->unlinked = 0;
+  freeInodes[numFreeInodes++] = id;
+}
+
+//function to give iNodes first to first+count-1 slots - their records are packed at records
+//slots come SLOT_CHUNK at a time, and the base table and chunks are multiples of that
+void addSlots(int first, int count, char *records){
+  for(int i=first; i<first+count; i++){
+    if(i % SLOT_CHUNK == 0){
+      slotTable[i / SLOT_CHUNK] = (inodeSlot *) calloc(SLOT_CHUNK, sizeof(inodeSlot));
+    }
+    inodeSlot *slot = getSlot(i);
+    slot->node = (iNode *)(records + (i - first) * INODE_SIZE);
+    pthread_rwlock_init(&slot->lock, NULL);
+  }
+  numInodes = first + count;
+}
+
+//function to get memory for the records of an iNode chunk - a cache line aligned buffer
+//NULL if there's none
+char* chunkMemory(){
+  char *records = NULL;
+  if(posix_memalign((void**)&records, 64, CHUNK_BLOCKS * BLOCK_SIZE) != 0){
+    return NULL;
+  }
+  return records;
+}
+
+//function to add a chunk of iNodes once every one is in use - CHUNK_BLOCKS contiguous blocks
+//from free space, written out blank before the iNode map (logged like the bitmap) points at
+//them. chunks are never given back. returns -1 (after saying why) if the map is full or there
+//is no run of blocks that long. caller holds nameLock for writing
+int growInodes(){
+  int c = (numInodes - BASE_INODES) / CHUNK_INODES;
+  if(c == MAP_CHUNKS){
+    printf("Too many files already exist - hit maximum\n");
+    return -1;
+  }
+  readLock(&metaLock);
+  lockMutex(&allocLock);
+  int start = findFreeRun(DATA_START, PARTION_SIZE, CHUNK_BLOCKS);
+  if(start != -1){
+    markBlocks(start, CHUNK_BLOCKS, 1);
+  }
+  unlockMutex(&allocLock);
+  char *records = (start == -1) ? NULL : chunkMemory();
+  if(records == NULL){
+    if(start != -1){
+      freeBlocks(start, CHUNK_BLOCKS);
+    }
+    unlockRW(&metaLock);
+    printf("No room left for more iNodes\n");
+    return -1;
+  }
+  bzero(records, CHUNK_BLOCKS * BLOCK_SIZE);
+  for(int k=0; k<CHUNK_INODES; k++){
+    ((iNode *)(records + k * INODE_SIZE))->numBytes = -1;
+  }
+  diskWrite(records, CHUNK_BLOCKS * BLOCK_SIZE, (off_t)start * BLOCK_SIZE);
+  inodeChunks[c] = records;
+  inodeMap[c] = start;
+  mapLogPending = 1;
+  mapCkptPending = 1;
+  unlockRW(&metaLock);
+
+  //the new iNodes go on the free stack lowest first
+  int first = numInodes;
+  addSlots(first, CHUNK_INODES, records);
+  freeInodes = (int *) realloc(freeInodes, numInodes * sizeof(int));
+  for(int i=numInodes-1; i>=first; i--){
+    freeInodes[numFreeInodes++] = i;
+  }
+  return 0;
+}
+
+//function to find the iNode a new file or directory gets - the lowest unused one, growing
+//the table if there isn't one. returns -1 (after saying why) if it can't grow
+//caller holds nameLock for writing and pops it off freeInodes once it has a name
+int nextInode(){
+  if(numFreeInodes == 0 && growInodes() != 0){
+    return -1;
+  }
+  return freeInodes[numFreeInodes-1];
+}
+
+//function to checksum a journal record and the data after it (FNV-1a)
+unsigned int logSum(const logRecord *rec, const char *data){
+  unsigned int h = 2166136261u;
+  const unsigned char *head = (const unsigned char *)rec;
+  for(int i=0; i<(int)offsetof(logRecord, sum); i++){
+    h = (h ^ head[i]) * 16777619u;
+  }
+  for(int i=0; i<rec->len; i++){
+    h = (h ^ (unsigned char)data[i]) * 16777619u;
+  }
+  return h;
+}
+
+//function to check if iNode id is in the table - the base one or a chunk in the iNode map
+int mappedInode(int id){
+  if(id < 0 || id >= MAX_INODES){
+    return 0;
+  }
+  return id < BASE_INODES || inodeMap[(id - BASE_INODES) / CHUNK_INODES] != 0;
+}
+
+//function to read iNode id as the replay has it so far - base iNodes from meta, chunk
+//iNodes from the partition (their records are redone by then). returns 0 if id isn't in
+//the table or isn't in use
+int replayInode(char *meta, int id, iNode *file){
+  if(!mappedInode(id)){
+    return 0;
+  }
+  if(id < BASE_INODES){
+    memcpy(file, meta + (INODE_START - 1) * BLOCK_SIZE + id * INODE_SIZE, sizeof(iNode));
+  }else if(pread(pFD, file, sizeof(iNode), inodePos(id)) != sizeof(iNode)){
+    return 0;
+  }
+  return file->numBytes != -1;
+}
+
+//function to check if partition byte pos is the start of a block of the directory file in
+//the replayed metadata - extent blocks have been redone by the time this is asked
+int replayDirBlock(iNode *file, off_t pos){
+  if(pos % BLOCK_SIZE != 0 || !file->isDir){
+    return 0;
+  }
+  int b = pos / BLOCK_SIZE;
+  extent more[EXTENTS_PER_BLOCK];
+  if(file->extentBlock != 0){
+    pread(pFD, more, sizeof(more), (off_t)file->extentBlock * BLOCK_SIZE);
+  }
+  for(int e=0; e<file->numExtents; e++){
+    extent *ext = (e < INLINE_EXTENTS) ? &file->extents[e] : &more[e - INLINE_EXTENTS];
+    if(b >= ext->start && b < ext->start + ext->length){
+      return 1;
+    }
+  }
+  return 0;
+}
+
+//function to redo every complete commit in the journal against the metadata in meta
+//records for chunk iNodes, extent blocks and directory nodes go straight to the partition
+//returns the bytes of records redone, or -1 if there is no journal
+int replayJournal(char *meta){
+  int size = JOURNAL_BLOCKS * BLOCK_SIZE;
+  char *log = (char *) malloc(size);
+  if(pread(pFD, log, size, (off_t)JOURNAL_START * BLOCK_SIZE) != size || ((journalHeader *)log)->magic != JOURNAL_MAGIC){
+    fprintf(stderr, "No metadata journal - not a bvfs partition\n");
+    free(log);
+    return -1;
+  }
+  journalEpoch = ((journalHeader *)log)->epoch;
+
+  //find the end of the last commit whose records all made it to disk
+  int at = BLOCK_SIZE;
+  int committed = BLOCK_SIZE;
+  while(at + (int)sizeof(logRecord) <= size){
+    logRecord rec;
+    memcpy(&rec, log + at, sizeof(rec));
+    if(rec.epoch != journalEpoch || rec.len < 0 || at + (int)sizeof(rec) + rec.len > size
+       || rec.sum != logSum(&rec, log + at + sizeof(rec))){
+      break;
+    }
+    at += sizeof(rec) + rec.len;
+    if(rec.len == 0){
+      committed = at;
+    }
+  }
+
+  //redo those records in order - the arena (base iNodes, iNode map, bitmap), then chunk
+  //iNodes, then extent blocks, then directory nodes
+  for(int pass=0; pass<4; pass++){
+    for(at = BLOCK_SIZE; at < committed; ){
+      logRecord rec;
+      memcpy(&rec, log + at, sizeof(rec));
+      char *data = log + at + sizeof(rec);
+      at += sizeof(rec) + rec.len;
+      int inArena = (rec.pos >= BLOCK_SIZE && rec.pos + rec.len <= (ARENA_BLOCKS + 1) * BLOCK_SIZE);
+      if(pass == 0 && inArena){
+        memcpy(meta + rec.pos - BLOCK_SIZE, data, rec.len);
+      }
+      if(inArena || rec.len == 0 || pass == 0){
+        continue;
+      }
+      //chunks are never freed, so a chunk iNode is always where the map says
+      iNode file;
+      if(pass == 1 && rec.owner >= BASE_INODES && mappedInode(rec.owner) && inodePos(rec.owner) == rec.pos){
+        pwrite(pFD, data, rec.len, rec.pos);
+      }
+      //an extent block or directory node may have been freed and reused since - only redo
+      //it if its iNode still has that block
+      if(pass == 2 && replayInode(meta, rec.owner, &file) && (off_t)file.extentBlock * BLOCK_SIZE == rec.pos){
+        pwrite(pFD, data, rec.len, rec.pos);
+      }
+      if(pass == 3 && replayInode(meta, rec.owner, &file) && replayDirBlock(&file, rec.pos)){
+        pwrite(pFD, data, rec.len, rec.pos);
+      }
+    }
+  }
+  free(log);
+
+  //new commits go after the ones we kept - they stay in the journal until the next checkpoint
+  journalUsed = committed - BLOCK_SIZE;
+  return journalUsed;
+}
+
+//function to let go of the iNode table - the slots, chunks read into memory and the free stack
+void freeInodeTable(){
+  for(int i=0; i<numInodes; i++){
+    pthread_rwlock_destroy(&getSlot(i)->lock);
+  }
+  for(int k=0; k*SLOT_CHUNK < numInodes; k++){
+    free(slotTable[k]);
+  }
+  for(int c=0; c<MAP_CHUNKS; c++){
+    free(inodeChunks[c]);
+  }
+  free(slotTable);
+  free(inodeChunks);
+  free(freeInodes);
+  slotTable = NULL;
+  inodeChunks = NULL;
+  freeInodes = NULL;
+  numInodes = 0;
+  numFreeInodes = 0;
+}
+
+//helper function to load data structures we use from disk into memory
+//base iNodes, the iNode map and the bitmap come in with one read into metaArena, and each
+//iNode chunk with one more. a mapped partition gets the same private copies - changing them
+//in the mapping would let the kernel write them home before the journal has them
+int buildMemStructs(){
+  //metadata is used in place from one read into the arena
+  free(metaArena);
+  metaArena = NULL;
+  if(posix_memalign((void**)&metaArena, 64, ARENA_BLOCKS * BLOCK_SIZE) != 0){
+    fprintf(stderr, "Unable to allocate the iNode table\n");
+    metaArena = NULL;
+    return -1;
+  }
+  if(pread(pFD, metaArena, ARENA_BLOCKS * BLOCK_SIZE, BLOCK_SIZE) != ARENA_BLOCKS * BLOCK_SIZE){
+    fprintf(stderr, "Unable to read the iNode table\n");
+    free(metaArena);
+    metaArena = NULL;
+    return -1;
+  }
+  char *meta = metaArena;
+
+  //bring the metadata up to the last commit before anything looks at it
+  inodeMap = (int *)(meta + (INODE_MAP_START - 1) * BLOCK_SIZE);
+  int replayed = replayJournal(meta);
+  if(replayed < 0){
+    free(metaArena);
+    metaArena = NULL;
+    return -1;
+  }
+
+  //the base iNodes are used in the arena, each chunk in the map comes in with one read
+  slotTable = (inodeSlot **) calloc(MAX_INODES / SLOT_CHUNK, sizeof(inodeSlot *));
+  inodeChunks = (char **) calloc(MAP_CHUNKS, sizeof(char *));
+  addSlots(0, BASE_INODES, meta + (INODE_START - 1) * BLOCK_SIZE);
+  for(int c=0; c<MAP_CHUNKS && inodeMap[c] != 0; c++){
+    inodeChunks[c] = chunkMemory();
+    if(inodeChunks[c] == NULL || pread(pFD, inodeChunks[c], CHUNK_BLOCKS * BLOCK_SIZE,
+       (off_t)inodeMap[c] * BLOCK_SIZE) != CHUNK_BLOCKS * BLOCK_SIZE){
+      fprintf(stderr, "Unable to read the iNode table\n");
+      freeInodeTable();
+      free(metaArena);
+      metaArena = NULL;
+      return -1;
+    }
+    addSlots(numInodes, CHUNK_INODES, inodeChunks[c]);
+  }
+  //replayed changes are only in the journal - the next checkpoint has to write them home
+  for(int i=0; i<numInodes; i++){
+    getSlot(i)->dirty = (replayed > 0);
+  }
+  numLogInodes = 0;
+  numLogNodes = 0;
+  mapLogPending = 0;
+  mapCkptPending = (replayed > 0);
+
+  //intialize filedescriptors - pushed backwards so 0 comes off first
+  numFreeFDs = 0;
+  for(int i=MAX_OPEN-1; i>=0; i--){
+    fdtArr[i].mode = -1;
+    fdtArr[i].cursor = 0;
+    fdtArr[i].isOpen = 0;
+    fdtArr[i].inode = -1;
+    fdtArr[i].raNext = 0;
+    fdtArr[i].raWindow = 0;
+    fdtArr[i].raEnd = 0;
+    fdtArr[i].stage = NULL;
+    fdtArr[i].stageLen = 0;
+    fdtArr[i].viewPins = NULL;
+    fdtArr[i].numViewPins = 0;
+    fdtArr[i].viewCopy = NULL;
+    fdtArr[i].viewCopied = 0;
+    freeFDs[numFreeFDs++] = i;
+  }
+
+  //Read extent blocks of files that have them
+  for(int i=0; i<numInodes; i++){
+    if(getInode(i)->numBytes != -1 && getInode(i)->extentBlock != 0){
+      getSlot(i)->more = (extent *) malloc(EXTENTS_PER_BLOCK * sizeof(extent));
+      diskRead((void*)getSlot(i)->more, EXTENTS_PER_BLOCK * sizeof(extent), (off_t)getInode(i)->extentBlock * BLOCK_SIZE);
+    }
+  }
+
+  //the bitmap follows the iNodes
+  freeMap = (unsigned int *)(meta + (BITMAP_START - 1) * BLOCK_SIZE);
+  mapDirtyLo = MAP_WORDS;
+  mapDirtyHi = -1;
+  ckptMapLo = (replayed > 0) ? 0 : MAP_WORDS;
+  ckptMapHi = (replayed > 0) ? MAP_WORDS - 1 : -1;
+  mapHint = DATA_START;
+
+  //directory trees come into memory whole
+  for(int i=0; i<numInodes; i++){
+    if(getInode(i)->numBytes != -1 && getInode(i)->isDir){
+      dirLoad(i);
+    }
+  }
+
+  //count everything with a name - an iNode without one (unlinked while open, then a crash)
+  //is freed here, and a file with one is cut back to its data
+  num_files = 0;
+  num_dirs = 0;
+  char *named = (char *) calloc(numInodes, 1);
+  named[ROOT_INODE] = 1;
+  dirMarkNamed(ROOT_INODE, named);
+  for(int i=0; i<numInodes; i++){
+    if(getInode(i)->numBytes != -1 && !named[i]){
+      removeDiskMap(i);
+      if(getInode(i)->isDir){
+        dirFree(i);
+      }
+      getInode(i)->numBytes = -1;
+      getInode(i)->isDir = 0;
+      touchInode(i);
+    }else if(getInode(i)->numBytes != -1 && !getInode(i)->isDir){
+      //blocks a writer still had reserved when the partition went down go back
+      trimFile(i);
+    }
+  }
+  free(named);
+
+  //the free iNode stack - pushed backwards so the lowest iNode comes off first
+  freeInodes = (int *) malloc(numInodes * sizeof(int));
+  numFreeInodes = 0;
+  for(int i=numInodes-1; i>=0; i--){
+    if(getInode(i)->numBytes == -1){
+      freeInodes[numFreeInodes++] = i;
+    }
+  }
+  return 0;
+}
+
+//function to write the runs of dirty blocks in a region home - block b of the region is
+//at mem + b * BLOCK_SIZE in memory and at block first + b on the partition
+void writeRuns(const char *dirty, int numBlocks, char *mem, int first){
+  for(int b=0; b<numBlocks; ){
+    if(!dirty[b]){
+      b++;
+      continue;
+    }
+    int end = b;
+    while(end < numBlocks && dirty[end]){
+      end++;
+    }
+    diskWrite((void*)(mem + b * BLOCK_SIZE), (end - b) * BLOCK_SIZE, (off_t)(first + b) * BLOCK_SIZE);
+    b = end;
+  }
+}
+
+//helper function to write the iNodes, extent blocks, directory nodes, iNode map and bitmap
+//changed since the last checkpoint back to disk - adjacent dirty blocks go out as one write
+void writeMetadata(){
+  //nothing may change iNodes, directories or the bitmap while they go out
+  readLock(&nameLock);
+  writeLock(&metaLock);
+  for(int d=0; d<numInodes; d++){
+    dirTree *t = &getSlot(d)->tree;
+    for(int n=0; n<t->numNodes; n++){
+      if(t->dirty[n] & DIR_CKPT){
+        diskWrite(t->nodes[n], BLOCK_SIZE, (off_t)t->blocks[n] * BLOCK_SIZE);
+      }
+      t->dirty[n] = 0;
+    }
+  }
+  //arena blocks holding a dirty iNode, the iNode map and the changed bitmap words
+  char *dirty = (char *) calloc(ARENA_BLOCKS, 1);
+  for(int i=0; i<numInodes; i++){
+    if(!getSlot(i)->dirty){
+      continue;
+    }
+    if(i < BASE_INODES){
+      dirty[(INODE_START - 1) + i * INODE_SIZE / BLOCK_SIZE] = 1;
+    }
+    if(getSlot(i)->more != NULL){
+      diskWrite((void*)getSlot(i)->more, EXTENTS_PER_BLOCK * sizeof(extent), (off_t)getInode(i)->extentBlock * BLOCK_SIZE);
+    }
+  }
+  if(mapCkptPending){
+    for(int b=0; b<INODE_MAP_BLOCKS; b++){
+      dirty[(INODE_MAP_START - 1) + b] = 1;
+    }
+  }
+  if(ckptMapHi >= ckptMapLo){
+    for(int b = ckptMapLo * (int)sizeof(int) / BLOCK_SIZE; b <= ckptMapHi * (int)sizeof(int) / BLOCK_SIZE; b++){
+      dirty[(BITMAP_START - 1) + b] = 1;
+    }
+  }
+  writeRuns(dirty, ARENA_BLOCKS, metaArena, INODE_START);
+  free(dirty);
+
+  //then each chunk's blocks holding a dirty iNode
+  dirty = (char *) calloc(CHUNK_BLOCKS, 1);
+  for(int c=0; BASE_INODES + c * CHUNK_INODES < numInodes; c++){
+    bzero(dirty, CHUNK_BLOCKS);
+    for(int k=0; k<CHUNK_INODES; k++){
+      if(getSlot(BASE_INODES + c * CHUNK_INODES + k)->dirty){
+        dirty[k * INODE_SIZE / BLOCK_SIZE] = 1;
+      }
+    }
+    writeRuns(dirty, CHUNK_BLOCKS, inodeChunks[c], inodeMap[c]);
+  }
+  free(dirty);
+
+  //everything is home now, including what the journal was still waiting on
+  for(int i=0; i<numInodes; i++){
+    getSlot(i)->dirty = 0;
+    getSlot(i)->logPending = 0;
+  }
+  numLogInodes = 0;
+  numLogNodes = 0;
+  mapLogPending = 0;
+  mapCkptPending = 0;
+  mapDirtyLo = MAP_WORDS;
+  mapDirtyHi = -1;
+  ckptMapLo = MAP_WORDS;
+  ckptMapHi = -1;
+  unlockRW(&metaLock);
+  unlockRW(&nameLock);
+}
+
+//function to push everything written to the partition so far onto the disk
+void syncPartition(){
+  if(diskMap != NULL){
+    msync(diskMap, (size_t)PARTION_SIZE * BLOCK_SIZE, MS_SYNC);
+  }
+  fdatasync(pFD);
+}
+
+//function to add one record to logBatch at byte at - returns where the next one goes
+//owner is the iNode the record belongs to, -1 for the iNode map, the bitmap and the commit record
+int logAppend(int at, off_t pos, const void *data, int len, int owner){
+  logRecord rec;
+  rec.epoch = journalEpoch;
+  rec.pos = pos;
+  rec.len = len;
+  rec.owner = owner;
+  rec.sum = logSum(&rec, (const char *)data);
+  memcpy(logBatch + at, &rec, sizeof(rec));
+  if(len > 0){
+    memcpy(logBatch + at + sizeof(rec), data, len);
+  }
+  return at + sizeof(rec) + len;
+}
+
+//function to gather every iNode, directory node, iNode map and bitmap change since the last
+//commit into logBatch - returns its length, 0 if nothing changed, or -1 if more iNodes or
+//directory nodes changed than a commit holds
+int logCapture(){
+  int at = 0;
+  readLock(&nameLock);
+  writeLock(&metaLock);
+  if(numLogInodes > LOG_INODES || numLogNodes > DIR_LOG_BLOCKS){
+    unlockRW(&metaLock);
+    unlockRW(&nameLock);
+    return -1;
+  }
+
+  for(int k=0; k<numLogInodes; k++){
+    int i = logInodes[k];
+    iNode *file = getInode(i);
+    at = logAppend(at, inodePos(i), file, INODE_SIZE, i);
+    //only the extents in use - the rest of the block doesn't matter
+    if(file->numBytes != -1 && getSlot(i)->more != NULL){
+      at = logAppend(at, (off_t)file->extentBlock * BLOCK_SIZE, getSlot(i)->more,
+                     (file->numExtents - INLINE_EXTENTS) * sizeof(extent), i);
+    }
+    getSlot(i)->logPending = 0;
+  }
+  numLogInodes = 0;
+  //only the entries in use of each changed node - a node can be gone again (its directory
+  //was removed, or shrank) by the time it's logged
+  for(int k=0; k<numLogNodes; k++){
+    int d = logNodes[k].dir;
+    int n = logNodes[k].n;
+    dirTree *t = &getSlot(d)->tree;
+    if(n < t->numNodes && (t->dirty[n] & DIR_LOG)){
+      dirNode *node = getNode(d, n);
+      at = logAppend(at, (off_t)t->blocks[n] * BLOCK_SIZE, node, sizeof(dirNode) + node->count * sizeof(dirEntry), d);
+      t->dirty[n] &= ~DIR_LOG;
+    }
+  }
+  numLogNodes = 0;
+  if(mapLogPending){
+    //chunks fill the map in order, so only the entries up to the last one can have changed
+    int used = (numInodes - BASE_INODES) / CHUNK_INODES;
+    at = logAppend(at, (off_t)INODE_MAP_START * BLOCK_SIZE, inodeMap, used * sizeof(int), -1);
+    mapLogPending = 0;
+  }
+  if(mapDirtyHi >= mapDirtyLo){
+    at = logAppend(at, (off_t)BITMAP_START * BLOCK_SIZE + mapDirtyLo * sizeof(int), &freeMap[mapDirtyLo],
+                   (mapDirtyHi - mapDirtyLo + 1) * sizeof(int), -1);
+    mapDirtyLo = MAP_WORDS;
+    mapDirtyHi = -1;
+  }
+  unlockRW(&metaLock);
+  unlockRW(&nameLock);
+
+  //the commit record - replay ignores anything not followed by one
+  if(at > 0){
+    at = logAppend(at, 0, NULL, 0, -1);
+  }
+  return at;
+}
+
+//function to write the len bytes logCapture gathered as the next commit - the data blocks go
+//to disk first, then the log records
+void logWrite(int len){
+  cacheFlush();
+  syncPartition();
+  pwrite(pFD, logBatch, len, (off_t)(JOURNAL_START + 1) * BLOCK_SIZE + journalUsed);
+  fdatasync(pFD);
+  journalUsed += len;
+}
+
+//function to write all metadata to its home blocks - the first half of a checkpoint
+//len is a commit logCapture gathered already (0 gathers it here). home can't get ahead of the
+//journal, or a crash before the journal starts over would replay older records over newer
+//blocks, so that commit goes in first - ordinary commits leave half the journal for it. only
+//one bigger than that (more iNodes or directory nodes changed than a commit holds, or over
+//half the journal of records) goes home without it
+void checkpointHome(int len){
+  if(len == 0){
+    len = logCapture();
+  }
+  if(len > 0 && journalUsed + len <= (JOURNAL_BLOCKS - 1) * BLOCK_SIZE){
+    logWrite(len);
+  }
+  cacheFlush();
+  writeMetadata();
+  syncPartition();
+}
+
+//function to write all metadata home and start the journal over
+//only the thread doing commits (or a single threaded mount/unmount) calls this
+void checkpoint(int len){
+  checkpointHome(len);
+
+  //a new epoch makes every record already in the journal stale
+  journalEpoch++;
+  journalUsed = 0;
+  char head[BLOCK_SIZE];
+  bzero(head, BLOCK_SIZE);
+  ((journalHeader *)head)->magic = JOURNAL_MAGIC;
+  ((journalHeader *)head)->epoch = journalEpoch;
+  pwrite(pFD, head, BLOCK_SIZE, (off_t)JOURNAL_START * BLOCK_SIZE);
+  fdatasync(pFD);
+}
+
+//function to write one commit, or a checkpoint that starts with it once the journal is half full
+void journalCommit(){
+  int len = logCapture();
+  if(len == 0){
+    return;
+  }
+  if(len < 0 || journalUsed + len > (JOURNAL_BLOCKS - 1) * BLOCK_SIZE / 2){
+    checkpoint(len);
+    return;
+  }
+  logWrite(len);
+}
+
+//function to make every metadata change so far durable - threads that ask while a
+//commit is being written wait and share the next one, so a batch costs one commit
+void logCommit(){
+  if(!threadSafe){
+    journalCommit();
+    return;
+  }
+  pthread_mutex_lock(&journalLock);
+  long ticket = ++commitWanted;
+  while(commitDone < ticket){
+    if(committing){
+      pthread_cond_wait(&journalCond, &journalLock);
+      continue;
+    }
+    //lead a commit for everyone who has asked so far
+    committing = 1;
+    long upTo = commitWanted;
+    pthread_mutex_unlock(&journalLock);
+    journalCommit();
+    pthread_mutex_lock(&journalLock);
+    committing = 0;
+    commitDone = upTo;
+    pthread_cond_broadcast(&journalCond);
+  }
+  pthread_mutex_unlock(&journalLock);
+}
+
+//function to move an inline file's bytes out to a block once a write needs more than
+//INLINE_DATA - the iNode holds extents again after. returns -1 if there's no block for them
+//or they couldn't be written - the file stays inline with its bytes either way. caller holds
+//metaLock shared and the iNode lock for writing
+int spillInline(int id){
+  iNode *file = getInode(id);
+  char bytes[INLINE_DATA];
+  memcpy(bytes, file->data, INLINE_DATA);
+  bzero(file->data, INLINE_DATA);
+  file->isInline = 0;
+  if(growFile(id, file->numBytes) < file->numBytes){
+    memcpy(file->data, bytes, INLINE_DATA);
+    file->isInline = 1;
+    return -1;
+  }
+  if(file->numBytes > 0){
+    ioSeg segs[MAX_EXTENTS];
+    int numSegs = planIO(id, 0, file->numBytes, bytes, segs);
+    if(cacheTransfer(segs, numSegs, 1) != file->numBytes){
+      //the block goes back (with whatever of it got cached) and the bytes back in the iNode
+      removeDiskMap(id);
+      memcpy(file->data, bytes, INLINE_DATA);
+      file->isInline = 1;
+      return -1;
+    }
+  }
+  touchInode(id);
+  return 0;
+}
+
+//function to write zeros over len bytes of a file from pos - the gap a write past the end leaves
+//caller holds the iNode lock and the blocks are already there. returns -1 if a write failed
+int zeroRange(int id, int pos, int len){
+  static const char zeros[4096] = {0};
+  while(len > 0){
+    int chunk = (len < (int)sizeof(zeros)) ? len : (int)sizeof(zeros);
+    ioSeg segs[MAX_EXTENTS];
+    int numSegs = planIO(id, pos, chunk, (char*)zeros, segs);
+    if(cacheTransfer(segs, numSegs, 1) != chunk){
+      return -1;
+    }
+    pos += chunk;
+    len -= chunk;
+  }
+  return 0;
+}
+
+//function to check that count bytes at pos stay inside the largest file there can be (INT_MAX
+//bytes) - without working out pos + count, which could overflow. returns 0 if they do
+int pastFileLimit(int pos, size_t count){
+  if(pos < 0 || count > (size_t)(INT_MAX - pos)){
+    printf("Writing there would take the file past %d bytes\n", INT_MAX);
+    return 1;
+  }
+  return 0;
+}
+
+//function to write count bytes at cursor in file id - existing blocks are overwritten in place,
+//the file grows for anything past its end, then the data goes through the cache
+//reserve keeps blocks past the new end for the next flush of a write-behind stage
+//returns bytes written or -1
+int fileWrite(int id, int cursor, const char *buf, int count, int reserve){
+  //nothing to write - the file stays as it is even if cursor is past its end
+  if(count <= 0){
+    return 0;
+  }
+  readLock(&metaLock);
+  writeLock(&getSlot(id)->lock);
+  //async writes land first - they go around the cache, and the end of the file has to be settled
+  aioSettle(id);
+  iNode *file = getInode(id);
+  //a small file lives in its iNode - no blocks to find and nothing for the disk until the commit
+  if(file->isInline && cursor + count <= INLINE_DATA){
+    if(cursor > file->numBytes){
+      bzero(file->data + file->numBytes, cursor - file->numBytes);
+    }
+    memcpy(file->data + cursor, buf, count);
+    if(cursor + count > file->numBytes){
+      file->numBytes = cursor + count;
+    }
+    file->time = time(NULL);
+    touchInode(id);
+    unlockRW(&getSlot(id)->lock);
+    unlockRW(&metaLock);
+    return count;
+  }
+  if(file->isInline && spillInline(id) != 0){
+    unlockRW(&getSlot(id)->lock);
+    unlockRW(&metaLock);
+    printf("NO BLOCKS LEFT\n");
+    return 0;
+  }
+  //make sure the file has every block this write needs before touching the disk
+  int room = growFile(id, cursor + count) - cursor;
+  if(room < count){
+    printf("NO BLOCKS LEFT\n");
+    count = (room > 0) ? room : 0;
+  }else if(reserve && cursor + count > file->numBytes){
+    reserveBlocks(id, cursor + count);
+  }
+  //a write past the end of the file - what it skips over reads back as zeros
+  if(count > 0 && cursor > file->numBytes && zeroRange(id, file->numBytes, cursor - file->numBytes) != 0){
+    count = -1;
+  }
+
+  //work out every piece of the write up front then send it out one I/O per run of blocks
+  ioSeg segs[MAX_EXTENTS];
+  int numSegs = (count > 0) ? planIO(id, cursor, count, (char*)buf, segs) : 0;
+  int totalBytesWritten = (count < 0) ? -1 : cacheTransfer(segs, numSegs, 1);
+  if(totalBytesWritten < 0){
+    touchInode(id);
+    unlockRW(&getSlot(id)->lock);
+    unlockRW(&metaLock);
+    printf("Write to partition failed\n");
+    return -1;
+  }
+
+  //Update iNode with appropriate numBytes and timestamp
+  if(cursor + totalBytesWritten > file->numBytes){
+    file->numBytes = cursor + totalBytesWritten;
+  }
+  file->time = time(NULL);
+  touchInode(id);
+  unlockRW(&getSlot(id)->lock);
+  unlockRW(&metaLock);
+  return totalBytesWritten;
+}
+
+//function to write out a descriptor's staged bytes - all of them, or only up to the
+//last block boundary so the rest can fill that block first. caller holds its stage lock
+//anything that couldn't be written is dropped and the cursor pulled back. returns 0 or -1
+int flushStage(fdTable *fdt, int all){
+  if(fdt->stageLen == 0){
+    return 0;
+  }
+  int start = fdt->cursor - fdt->stageLen;
+  int len = all ? fdt->stageLen : (start + fdt->stageLen) / BLOCK_SIZE * BLOCK_SIZE - start;
+  if(len <= 0){
+    return 0;
+  }
+  int done = fileWrite(fdt->inode, start, fdt->stage, len, 1);
+  if(done < len){
+    fdt->cursor = start + ((done > 0) ? done : 0);
+    fdt->stageLen = 0;
+    return -1;
+  }
+  fdt->stageLen -= len;
+  memmove(fdt->stage, fdt->stage + len, fdt->stageLen);
+  return 0;
+}
+
+//function to write out every descriptor's staged bytes
+void flushAllStages(){
+  for(int i=0; i<MAX_OPEN; i++){
+    lockMutex(&stageLocks[i]);
+    //a descriptor flushes before it closes, so anything staged still has its file
+    if(fdtArr[i].stageLen > 0){
+      flushStage(&fdtArr[i], 1);
+    }
+    unlockMutex(&stageLocks[i]);
+  }
+}
+
+//background flusher - every flushInterval ms staged writes go to the cache and get committed
+void *flusherMain(void *){
+  pthread_mutex_lock(&flushLock);
+  while(!flusherStop){
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += flushInterval / 1000;
+    until.tv_nsec += (flushInterval % 1000) * 1000000L;
+    if(until.tv_nsec >= 1000000000L){
+      until.tv_sec++;
+      until.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&flushCond, &flushLock, &until);
+    if(flusherStop){
+      break;
+    }
+    pthread_mutex_unlock(&flushLock);
+    flushAllStages();
+    logCommit();
+    pthread_mutex_lock(&flushLock);
+  }
+  pthread_mutex_unlock(&flushLock);
+  return NULL;
+}
+
+//function to read up to count bytes of a file from pos - stops at the end of the file
+//reads that pick up where the descriptor's last one ended grow its readahead window
+//returns bytes read or -1
+int fileRead(fdTable *fdt, char *buf, int count, int pos){
+  int id = fdt->inode;
+  readLock(&getSlot(id)->lock);
+  int left = getInode(id)->numBytes - pos;
+  if(count > left){
+    count = (left > 0) ? left : 0;
+  }
+  //an inline file is in memory already
+  if(getInode(id)->isInline){
+    if(count > 0){
+      memcpy(buf, getInode(id)->data + pos, count);
+    }
+    unlockRW(&getSlot(id)->lock);
+    fdt->raNext = pos + count;
+    return count;
+  }
+  //reads that pick up where the last one ended grow the readahead window, anything else stops it
+  if(pos == fdt->raNext){
+    fdt->raWindow = (fdt->raWindow == 0) ? RA_MIN_BLOCKS : fdt->raWindow * 2;
+    if(fdt->raWindow > readaheadMax){
+      fdt->raWindow = readaheadMax;
+    }
+  }else{
+    fdt->raWindow = 0;
+    fdt->raEnd = 0;
+  }
+  if(fdt->raWindow > 0 && count > 0){
+    int first = pos / BLOCK_SIZE;
+    int last = (pos + count - 1) / BLOCK_SIZE;
+    //top the window up once the reader is within half a window of its end
+    //a small read is fetched along with it - a big one goes around the cache anyway
+    if(last + fdt->raWindow / 2 >= fdt->raEnd){
+      int from = (last - first < readaheadMax) ? first : last + 1;
+      if(from < fdt->raEnd){
+        from = fdt->raEnd;
+      }
+      int to = last + 1 + fdt->raWindow;
+      int fileBlocks = (getInode(id)->numBytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+      if(to > fileBlocks){
+        to = fileBlocks;
+      }
+      if(to > from + MAX_IOV){
+        to = from + MAX_IOV;
+      }
+      cacheReadahead(id, from, to - from);
+      fdt->raEnd = to;
+    }
+  }
+
+  //work out every piece of the read up front then read each run of blocks at once
+  ioSeg segs[MAX_EXTENTS];
+  int numSegs = planIO(id, pos, count, buf, segs);
+  int totalBytesRead = cacheTransfer(segs, numSegs, 0);
+  unlockRW(&getSlot(id)->lock);
+  if(totalBytesRead < 0){
+    printf("Read from partition failed\n");
+    return -1;
+  }
+  fdt->raNext = pos + totalBytesRead;
+  return totalBytesRead;
+}
+
+/*
+ * int bv_init(const char *fs_fileName);
+ *
+ * Initializes the bvfs file system based on the provided file. This file will
+ * contain the entire stored file system. Invocation of this function will do
+ * one of two things:
+ *
+ *   1) If the file (fs_fileName) exists, the function will initialize in-memory
+ *   data structures to help manage the file system methods that may be invoked.
+ *
+ *   2) If the file (fs_fileName) does not exist, the function will create that
+ *   file as the representation of a new file system and initialize in-memory
+ *   data structures to help manage the file system methods that may be invoked.
+ *
+ * Input Parameters
+ *   fs_fileName: A c-string representing the file on disk that stores the bvfs
+ *   file system data.
+ *
+ * Return Value
+ *   int:  0 if the initialization succeeded.
+ *        -1 if the initialization failed (eg. file not found, access denied,
+ *           etc.). Also, print a meaningful error to stderr prior to returning.
+ */
+int bv_init(const char *fs_fileName) {
+  return bv_init_opts(fs_fileName, NULL);
+}
+
+// Available flags for bv_init_opts
+int BV_MMAP = 1;
+int BV_THREADSAFE = 2;
+int BV_URING = 4;
+
+/*
+ * int bv_init_opts(const char *fs_fileName, const bvOptions *opts);
+ *
+ * Same as bv_init but takes mount options. opts may be NULL for the defaults.
+ *
+ * Input Parameters
+ *   fs_fileName: A c-string representing the file on disk that stores the bvfs
+ *   file system data.
+ *   opts: Mount options
+ *           - flags: BV_MMAP maps the whole partition into memory. Reads and
+ *             writes of file data become memcpys against the mapping. Metadata
+ *             is still changed in private memory and only written home at a
+ *             checkpoint, so a crash is recovered from the journal as without
+ *             it. bv_destroy msyncs and unmaps it.
+ *             BV_THREADSAFE lets several threads call into bvfs at once. Each
+ *             iNode gets a reader-writer lock, and the name table, descriptor
+ *             table, allocator and cache each get their own. A single file
+ *             descriptor still belongs to one thread at a time.
+ *             BV_URING runs bv_read_async/bv_write_async through io_uring,
+ *             with the partition registered as a fixed file. Without it (or
+ *             if the kernel has no io_uring) they complete synchronously.
+ *           - cacheBlocks: blocks in the buffer cache, 0 for the default,
+ *             -1 for no cache.
+ *           - ioBuffer/ioBufferSize: memory most async requests will read
+ *             into or write from. Under BV_URING it is registered with the
+ *             ring so requests inside it skip the per-I/O page pinning. May
+ *             be NULL.
+ *           - flushMs: with BV_THREADSAFE, a background thread writes out
+ *             staged writes (see bv_write) and commits them this often.
+ *             0 for no flusher.
+ *           - blockSize/blockCount: only used when fs_fileName doesn't exist
+ *             yet. The block size (a power of 2 from 512 to 65536, 4096
+ *             matches the page cache) and number of blocks to format with -
+ *             0 for 512 and 8 MiB worth, at most 2^30 blocks. They are kept
+ *             in the superblock, so mounting an existing partition always uses
+ *             its own geometry. The iNode map is sized from them too - the
+ *             table can grow to a chunk of 16 blocks per 64 blocks of the
+ *             partition (blockCount / 64 * blockSize / 8 + 256 iNodes, at
+ *             most 2^24). Partitions from an older layout won't mount and
+ *             have to be formatted again.
+ *
+ * Return Value
+ *   int:  0 if the initialization succeeded.
+ *        -1 if the initialization failed. Also, print a meaningful error to
+ *           stderr prior to returning.
+ */
+int bv_init_opts(const char *fs_fileName, const bvOptions *opts) {
+  int flags = (opts != NULL) ? opts->flags : 0;
+  int cacheBlocks = (opts != NULL && opts->cacheBlocks != 0) ? opts->cacheBlocks : DEFAULT_CACHE_BLOCKS;
+  diskMap = NULL;
+  threadSafe = 0;
+  //no ring or async requests until the partition is up - a mount after a crash starts clean
+  ringFD = -1;
+  aioInit();
+
+  //geometry for a new partition - 8 MiB worth of blocks unless told otherwise
+  int blockSize = (opts != NULL && opts->blockSize != 0) ? opts->blockSize : 512;
+  int blockCount = (opts != NULL && opts->blockCount != 0) ? opts->blockCount : 8388608 / blockSize;
+
+  pFD = open(fs_fileName, O_CREAT | O_RDWR | O_EXCL, 0644);
+  if (pFD < 0) {
+    if (errno == EEXIST) {
+      // File already exists. Open it and read its geometry back
+      pFD = open(fs_fileName, O_CREAT | O_RDWR , S_IRUSR | S_IWUSR);
+      if(pFD < 0 || readSuperBlock(pFD) != 0){
+        if(pFD >= 0) close(pFD);
+        return -1;
+      }
+    }
+    else {
+      // Something bad must have happened... check errno?
+      fprintf(stderr, "%s", strerror(errno));
+      return -1;
+    }
+
+  } else {
+    // File did not previously exist
+    if(checkGeometry(blockSize, blockCount) != 0){
+      close(pFD);
+      unlink(fs_fileName);
+      return -1;
+    }
+    //build the whole metadata area (superblock, iNodes, bitmap, journal) in memory
+    //so formatting is one write no matter how many iNodes there are
+    char *image = (char*)calloc(DATA_START, BLOCK_SIZE);
+    if(image == NULL){
+      fprintf(stderr, "Unable to allocate the format image\n");
+      close(pFD);
+      unlink(fs_fileName);
+      return -1;
+    }
+
+    superBlock sb = {SUPER_MAGIC, SUPER_VERSION, BLOCK_SIZE, PARTION_SIZE, BASE_INODES,
+                     INODE_START, INODE_MAP_START, BITMAP_START, JOURNAL_START, JOURNAL_BLOCKS, DATA_START};
+    memcpy(image, &sb, sizeof(sb));
+
+    //numBytes is used to check if that iNode is assigned a file - the iNode map starts out empty
+    for(int i=0; i<BASE_INODES; i++)
+      ((iNode*)(image + (off_t)INODE_START * BLOCK_SIZE + i * INODE_SIZE))->numBytes = -1;
+
+    //an empty root directory - it gets a block with its first entry
+    iNode *root = (iNode*)(image + (off_t)INODE_START * BLOCK_SIZE + ROOT_INODE * INODE_SIZE);
+    root->numBytes = 0;
+    root->isDir = 1;
+    root->time = time(NULL);
+
+    //the free space bitmap - everything before the data blocks is in use
+    freeMap = (unsigned int *)(image + (off_t)BITMAP_START * BLOCK_SIZE);
+    markBlocks(0, DATA_START, 1);
+
+    //an empty journal
+    ((journalHeader *)(image + (off_t)JOURNAL_START * BLOCK_SIZE))->magic = JOURNAL_MAGIC;
+    ((journalHeader *)(image + (off_t)JOURNAL_START * BLOCK_SIZE))->epoch = 1;
+
+    ssize_t wrote = pwrite(pFD, image, (off_t)DATA_START * BLOCK_SIZE, 0);
+    free(image);
+
+    //grow the file to the full partition size - data blocks stay sparse
+    if(wrote != (off_t)DATA_START * BLOCK_SIZE || ftruncate(pFD, (off_t)PARTION_SIZE * BLOCK_SIZE) != 0){
+      fprintf(stderr, "Unable to format %s: %s\n", fs_fileName, strerror(errno));
+      close(pFD);
+      unlink(fs_fileName);
+      return -1;
+    }
+  }
+
+  //map the whole partition if asked to
+  if(flags & BV_MMAP){
+    void *map = mmap(NULL, (size_t)PARTION_SIZE * BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, pFD, 0);
+    if(map == MAP_FAILED){
+      fprintf(stderr, "Couldn't map partition: %s\n", strerror(errno));
+      close(pFD);
+      return -1;
+    }
+    diskMap = (char *)map;
+  }
+
+  //commits are gathered here - sized for this geometry
+  free(logBatch);
+  logBatch = (char *) malloc(LOG_BATCH_MAX);
+
+  //set up all data structures in memory
+  if(buildMemStructs() != 0){
+    if(diskMap != NULL){
+      munmap(diskMap, (size_t)PARTION_SIZE * BLOCK_SIZE);
+      diskMap = NULL;
+    }
+    close(pFD);
+    return -1;
+  }
+  //the mapping already caches every block
+  cacheInit((diskMap != NULL) ? 0 : cacheBlocks);
+
+  //async requests go through io_uring if asked for - a mapping is faster without it
+  if((flags & BV_URING) && diskMap == NULL){
+    ringInit(opts->ioBuffer, opts->ioBufferSize);
+  }
+
+  if(flags & BV_THREADSAFE){
+    initLocks();
+    threadSafe = 1;
+  }
+
+  flushInterval = 0;
+  if(threadSafe && opts->flushMs > 0){
+    flusherStop = 0;
+    pthread_mutex_init(&flushLock, NULL);
+    pthread_cond_init(&flushCond, NULL);
+    flushInterval = opts->flushMs;
+    if(pthread_create(&flusher, NULL, flusherMain, NULL) != 0){
+      fprintf(stderr, "Couldn't start the flusher - staged writes wait for bv_close/bv_fsync\n");
+      flushInterval = 0;
+    }
+  }
+  return 0;
+}
+
+
+/*
+ * int bv_destroy();
+ *
+ * This is your opportunity to free any dynamically allocated resources and
+ * perhaps to write any remaining changes to disk that are necessary to finalize
+ * the bvfs file before exiting.
+ *
+ * Return Value
+ *   int:  0 if the clean-up process succeeded.
+ *        -1 if the clean-up process failed (eg. bv_init was not previously,
+ *           called etc.). Also, print a meaningful error to stderr prior to
+ *           returning.
+ */
+int bv_destroy() {
+  //stop the flusher and write out whatever descriptors left open still have staged
+  if(flushInterval > 0){
+    pthread_mutex_lock(&flushLock);
+    flusherStop = 1;
+    pthread_cond_signal(&flushCond);
+    pthread_mutex_unlock(&flushLock);
+    pthread_join(flusher, NULL);
+    pthread_mutex_destroy(&flushLock);
+    pthread_cond_destroy(&flushCond);
+    flushInterval = 0;
+  }
+  flushAllStages();
+  for(int i=0; i<MAX_OPEN; i++){
+    free(fdtArr[i].stage);
+    fdtArr[i].stage = NULL;
+    free(fdtArr[i].viewPins);
+    fdtArr[i].viewPins = NULL;
+    fdtArr[i].numViewPins = 0;
+    free(fdtArr[i].viewCopy);
+    fdtArr[i].viewCopy = NULL;
+    fdtArr[i].viewCopied = 0;
+  }
+  //and give back what writers (or a crash) left reserved - a directory's spare nodes stay
+  for(int i=0; i<numInodes; i++){
+    if(getInode(i)->numBytes != -1 && !getInode(i)->isDir){
+      trimFile(i);
+    }
+  }
+
+  //files unlinked while still open go away now
+  for(int i=0; i<numInodes; i++){
+    if(getSlot(i)->unlinked){
+      releaseInode(i);
+    }
+  }
+
+  //async writes still in flight have to land before the checkpoint
+  ringFree();
+
+  //write back dirty blocks and all the metadata we are holding - the journal is empty after
+  checkpoint(0);
+  cacheFree();
+  for(int i=0; i<numInodes; i++){
+    dirFree(i);
+    free(getSlot(i)->more);
+  }
+  freeInodeTable();
+  free(logBatch);
+  logBatch = NULL;
+
+  if(diskMap != NULL){
+    munmap(diskMap, (size_t)PARTION_SIZE * BLOCK_SIZE);
+    diskMap = NULL;
+  }
+  //free the arena
+  free(metaArena);
+  metaArena = NULL;
+  freeMap = NULL;
+  inodeMap = NULL;
+
+  if(threadSafe){
+    threadSafe = 0;
+    destroyLocks();
+  }
+
+  //close file descriptor
+  close(pFD);
+  return 0;
+}
+
+/*
+ * int bv_sync();
+ *
+ * Makes everything written so far survive without a bv_destroy. Staged
+ * writes of every descriptor are written out and dirty blocks in the buffer
+ * cache go to the partition first, then the iNode, directory node and
+ * bitmap changes are logged to the metadata journal as one commit, which the
+ * next bv_init replays. Only iNodes and nodes changed since the last commit
+ * are logged. bv_close (of a writer), bv_unlink, bv_mkdir, bv_rmdir and
+ * bv_fsync commit the same way, and threads committing at the same time
+ * share one commit.
+ *
+ * The journal is emptied by a checkpoint (bv_destroy, when it is half full, or
+ * when a commit changed more directory nodes than it can hold). A checkpoint
+ * logs what changed since the last commit first, then writes only the iNode,
+ * directory node and bitmap blocks changed since the last checkpoint, one
+ * write per run of adjacent blocks.
+ *
+ * Return Value
+ *   int:  0 if the sync succeeded.
+ */
+int bv_sync() {
+  flushAllStages();
+  logCommit();
+  return 0;
+}
+
+/*
+ * int bv_fsync(int bvfs_FD);
+ *
+ * Makes everything written to an open file so far survive without a bv_close
+ * or bv_destroy. Writes staged on this descriptor are written out first. The
+ * commit only logs iNodes changed since the last one, so this costs the same
+ * as bv_sync and covers the other changed files too.
+ *
+ * Input Parameters
+ *   bvfs_FD: The identifier for the file to make durable.
+ *
+ * Return Value
+ *   int:  0 if the sync succeeded.
+ *        -1 if the file is not currently opened via bv_open. Also, print a
+ *           meaningful error to stderr prior to returning.
+ */
+int bv_fsync(int bvfs_FD) {
+  fdTable *fdt = getFD(bvfs_FD);
+  if(fdt == NULL){
+    printf("File is not open\n");
+    return -1;
+  }
+  lockMutex(&stageLocks[bvfs_FD]);
+  int ret = flushStage(fdt, 1);
+  unlockMutex(&stageLocks[bvfs_FD]);
+  logCommit();
+  return ret;
+}
+
+/*
+ * void bv_cache_stats(bvCacheStats *stats);
+ *
+ * Fills stats with the buffer cache counters since bv_init: block hits, block
+ * misses, dirty blocks written back, and blocks read ahead of a sequential
+ * reader. Useful for sizing the cache with bvOptions.cacheBlocks.
+ *
+ * Readahead is per descriptor. Once a read starts where the last one ended,
+ * the next blocks of the file are read into the cache with one I/O per run,
+ * and the window doubles (from 4 blocks up to a quarter of the cache) while
+ * reads stay sequential. Any other read turns it off.
+ */
+void bv_cache_stats(bvCacheStats *stats) {
+  *stats = cacheStats;
+}
+
+// Available Modes for bvfs (see bv_open below)
+int BV_RDONLY = 0;
+int BV_WCONCAT = 1;
+int BV_WTRUNC = 2;
+int BV_RDWR = 3;
+
+//function to check if a descriptor can be read from - BV_RDWR reads and writes
+int canRead(fdTable *fdt){
+  return fdt->mode == BV_RDONLY || fdt->mode == BV_RDWR;
+}
+
+//function to write out what a BV_RDWR descriptor has staged before it reads
+//(the stage can hold bytes the read covers). does nothing for the other modes
+void settleStage(int bvfs_FD){
+  fdTable *fdt = &fdtArr[bvfs_FD];
+  if(fdt->mode != BV_RDWR){
+    return;
+  }
+  lockMutex(&stageLocks[bvfs_FD]);
+  flushStage(fdt, 1);
+  unlockMutex(&stageLocks[bvfs_FD]);
+}
+
+/*
+ * int bv_open(const char *fileName, int mode);
+ *
+ * This function is intended to open a file in either read or write mode. The
+ * above modes identify the method of access to utilize. If the file does not
+ * exist, you will create it. The function should return a bvfs file descriptor
+ * for the opened file which may be later used with bv_(close/write/read).
+ *
+ * Input Parameters
+ *   fileName: A c-string representing the path of the file you wish to fetch
+ *             (or create) in the bvfs file system - names separated by '/',
+ *             starting from the root directory. Every directory on the way
+ *             has to exist already (see bv_mkdir).
+ *   mode: The access mode to use for accessing the file
+ *           - BV_RDONLY: Read only mode
+ *           - BV_WCONCAT: Write only mode, appending to the end of the file
+ *           - BV_WTRUNC: Write only mode, replacing the file and writing anew.
+ *             Refused while the file is open on any other descriptor.
+ *           - BV_RDWR: Read and write mode, starting at the beginning of the
+ *             file. Writes overwrite what is there in place and the file
+ *             only grows for bytes past its end. Counts as the writer.
+ *
+ * Return Value
+ *   int: >=0 Greater-than or equal-to zero value representing the bvfs file
+ *           descriptor on success.
+ *        -1 if some kind of failure occurred. Also, print a meaningful error to
+ *           stderr prior to returning.
+ */
+int bv_open(const char *fileName, int mode) {
+  if(mode > 3 || mode < 0){
+    printf("Invalid  Mode\n");
+    return -1;
+  }
+
+  //grab a file descriptor first so we never create a file we can't open
+  lockMutex(&fdLock);
+  if(numFreeFDs == 0){
+    unlockMutex(&fdLock);
+    printf("Too many open files\n");
+    return -1;
+  }
+  int fd = freeFDs[--numFreeFDs];
+  unlockMutex(&fdLock);
+
+  //check if we need to create the file or not - only creating needs the directories to ourselves
+  char key[FILE_NAME_SIZE];
+  readLock(&nameLock);
+  int dir = resolvePath(fileName, key);
+  int i = (dir == -1) ? -1 : dirLookup(dir, key);
+  if(dir != -1 && i == -1 && mode != BV_RDONLY){
+    unlockRW(&nameLock);
+    writeLock(&nameLock);
+    dir = resolvePath(fileName, key);
+    i = (dir == -1) ? -1 : dirLookup(dir, key);
+  }
+  if(i != -1 && getInode(i)->isDir){
+    printf("%s is a directory\n", fileName);
+    i = -1;
+  }
+  else if(i == -1 && dir != -1){
+    //if it gets this far the file doesn't exist
+    if(mode == BV_RDONLY){
+      //cant open a new file to read from
+      printf("Tried to read a file that deosn't exist\n");
+    }
+    else if(nextInode() == -1){
+      //the iNode table is as big as it gets, or there's no room to grow it
+    }
+    else if(dirInsert(dir, key, freeInodes[numFreeInodes-1]) == -1){
+      printf("No room left for the directory entry\n");
+    }
+    else{
+      //file doesn't exist so make it with the first unused iNode
+      i = freeInodes[--numFreeInodes];
+      readLock(&metaLock);
+      writeLock(&getSlot(i)->lock);
+      //set up iNode including its time
+      getInode(i)->time = time(NULL);
+      getInode(i)->isDir = 0;
+      emptyFile(i);
+      touchInode(i);
+      unlockRW(&getSlot(i)->lock);
+      unlockRW(&metaLock);
+      num_files ++;
+    }
+  }
+
+  //found a file with that name - any number of readers but only one writer
+  lockMutex(&fdLock);
+  if(i != -1 && mode != BV_RDONLY && getSlot(i)->writerCount > 0){
+    printf("File is already open for writing\n");
+    i = -1;
+  }
+  else if(i != -1 && mode == BV_WTRUNC && getSlot(i)->openCount > 0){
+    //truncating would free the blocks readers (and their views) are still reading
+    printf("File is open for reading\n");
+    i = -1;
+  }
+  if(i == -1){
+    freeFDs[numFreeFDs++] = fd;
+    unlockMutex(&fdLock);
+    unlockRW(&nameLock);
+    return -1;
+  }
+  getSlot(i)->openCount++;
+  if(mode != BV_RDONLY){
+    getSlot(i)->writerCount++;
+  }
+  unlockMutex(&fdLock);
+  unlockRW(&nameLock);
+
+  readLock(&metaLock);
+  writeLock(&getSlot(i)->lock);
+  if(mode == BV_WTRUNC){
+    //truncate - erase all data (and blocks)
+    removeDiskMap(i);
+    emptyFile(i);
+    touchInode(i);
+  }
+
+  //set up file descriptor
+  fdTable *fdt = &fdtArr[fd];
+  fdt->mode = mode;
+  fdt->inode = i;
+  //concat - set cursor to end of that file, otherwise start at 0
+  fdt->cursor = (mode == BV_WCONCAT) ? getInode(i)->numBytes : 0;
+  fdt->raNext = fdt->cursor;
+  fdt->raWindow = 0;
+  fdt->raEnd = 0;
+  fdt->isOpen = 1;
+  unlockRW(&getSlot(i)->lock);
+  unlockRW(&metaLock);
+  return fd;
+}
+
+/*
+ * int bv_close(int bvfs_FD);
+ *
+ * This function is intended to close a file that was previously opened via a
+ * call to bv_open. This will allow you to perform any finalizing writes needed
+ * to the bvfs file system.
+ *
+ * Input Parameters
+ *   fileName: A c-string representing the name of the file you wish to fetch
+ *             (or create) in the bvfs file system.
+ *
+ * Return Value
+ *   int:  0 if open succeeded.
+ *        -1 if some kind of failure occurred (eg. the file was not previously
+ *           opened via bv_open, or staged writes couldn't be written out -
+ *           the file is still closed). Also, print a meaningful error to
+ *           stderr prior to returning.
+ */
+int bv_close(int bvfs_FD) {
+  //check if file is open - if not return -1
+  fdTable *fdt = getFD(bvfs_FD);
+  if(fdt == NULL){
+    printf("File is not open\n");
+    return -1;
+  }
+  int id = fdt->inode;
+  int wrote = (fdt->mode != BV_RDONLY);
+
+  //staged writes go out before the descriptor does
+  lockMutex(&stageLocks[bvfs_FD]);
+  int ret = flushStage(fdt, 1);
+  free(fdt->stage);
+  fdt->stage = NULL;
+  unlockMutex(&stageLocks[bvfs_FD]);
+  releaseViews(fdt);
+  free(fdt->viewPins);
+  fdt->viewPins = NULL;
+  free(fdt->viewCopy);
+  fdt->viewCopy = NULL;
+
+  //blocks the writer kept reserved go back
+  if(wrote){
+    readLock(&metaLock);
+    writeLock(&getSlot(id)->lock);
+    trimFile(id);
+    unlockRW(&getSlot(id)->lock);
+    unlockRW(&metaLock);
+  }
+
+  //Reset the file descriptor
+  lockMutex(&fdLock);
+  getSlot(id)->openCount--;
+  if(fdt->mode != BV_RDONLY){
+    getSlot(id)->writerCount--;
+  }
+  fdt->mode = -1;
+  fdt->cursor = 0;
+  fdt->isOpen = 0;
+  fdt->inode = -1;
+  freeFDs[numFreeFDs++] = bvfs_FD;
+  int lastClose = (getSlot(id)->openCount == 0 && getSlot(id)->unlinked);
+  unlockMutex(&fdLock);
+
+  //last close of an unlinked file frees it - nobody can find it by name anymore
+  if(lastClose){
+    writeLock(&nameLock);
+    releaseInode(id);
+    unlockRW(&nameLock);
+  }
+
+  //the file's iNode and the blocks it took or gave back become durable
+  if(wrote || lastClose){
+    logCommit();
+  }
+  return ret;
+}
+
+/*
+ * int bv_write(int bvfs_FD, const void *buf, size_t count);
+ *
+ * This function will write count bytes from buf into a location corresponding
+ * to the cursor of the file represented by bvfs_FD.
+ *
+ * Writes smaller than STAGE_SIZE are staged in a buffer belonging to the
+ * descriptor and only reach the file, a block at a time, once it fills - or
+ * on bv_close, bv_fsync, bv_sync or the background flusher (bvOptions
+ * flushMs). Until then other descriptors don't see them, and running out of
+ * space is reported when they are written out.
+ *
+ * Input Parameters
+ *   bvfs_FD: The identifier for the file to write to.
+ *   buf: The buffer containing the data we wish to write to the file.
+ *   count: The number of bytes we intend to write from the buffer to the file.
+ *
+ * Return Value
+ *   int: >=0 Value representing the number of bytes written to the file.
+ *        -1 if some kind of failure occurred (eg. the file is not currently
+ *           opened via bv_open, or the write would take the file past
+ *           INT_MAX bytes). Also, print a meaningful error to stderr prior
+ *           to returning.
+ */
+int bv_write(int bvfs_FD, const void *buf, size_t count) {
+  //checking if file is open
+  fdTable *fdt = getFD(bvfs_FD);
+  if(fdt == NULL){
+    printf("File is not open %d\n",bvfs_FD); 
+    return -1;
+  }
+  //checking mode
+  if(fdt->mode == BV_RDONLY){
+    printf("File opened in wrong mode\n");
+    return -1;
+  }
+  else if(pastFileLimit(fdt->cursor, count)){
+    return -1;
+  }
+  else{
+    //should be to the point where we can write
+    lockMutex(&stageLocks[bvfs_FD]);
+    int totalBytesWritten = count;
+    if(fdt->stage == NULL && count < (size_t)STAGE_SIZE){
+      fdt->stage = (char*)malloc(STAGE_SIZE);
+    }
+    if(fdt->stage != NULL && count < (size_t)STAGE_SIZE){
+      //small writes only copy into the stage - whole blocks go out once it fills
+      if(fdt->stageLen + (int)count > STAGE_SIZE){
+        flushStage(fdt, 0);
+      }
+      if(fdt->stageLen + (int)count > STAGE_SIZE && flushStage(fdt, 1) != 0){
+        totalBytesWritten = 0;
+      }else{
+        memcpy(fdt->stage + fdt->stageLen, buf, count);
+        fdt->stageLen += count;
+        fdt->cursor += count;
+      }
+    }else{
+      //big writes go straight out, after anything staged ahead of them
+      if(flushStage(fdt, 1) != 0){
+        totalBytesWritten = 0;
+      }else{
+        totalBytesWritten = fileWrite(fdt->inode, fdt->cursor, (const char*)buf, count, 0);
+        if(totalBytesWritten > 0){
+          fdt->cursor += totalBytesWritten;
+        }
+      }
+    }
+    unlockMutex(&stageLocks[bvfs_FD]);
+    return totalBytesWritten;
+  }
+}
+
+/*
+ * int bv_read(int bvfs_FD, void *buf, size_t count);
+ *
+ * This function will read count bytes from the location corresponding to the
+ * cursor of the file (represented by bvfs_FD) to buf. A read that runs into
+ * the end of the file comes back short, and one at the end returns 0.
+ *
+ * Input Parameters
+ *   bvfs_FD: The identifier for the file to read from.
+ *   buf: Th/e buffer that we will write the data to.
+ *   count: The number of bytes we intend to write to the buffer from the file.
+ *
+ * Return Value
+ *   int: >=0 Value representing the number of bytes written to buf.
+ *        -1 if some kind of failure occurred (eg. the file is not currently
+ *           opened via bv_open for reading). Also, print a meaningful error
+ *           to stderr prior to returning.
+ */
+int bv_read(int bvfs_FD, void *buf, size_t count) {
+  //check if file is open
+  fdTable *fdt = getFD(bvfs_FD);
+  if(fdt == NULL){
+    printf("File is not open\n");
+    return -1;
+  }
+  //check mode
+  if(canRead(fdt)){
+    settleStage(bvfs_FD);
+    //no file is longer than INT_MAX, so a bigger count only reads to the end
+    int totalBytesRead = fileRead(fdt, (char*)buf, (count > (size_t)INT_MAX) ? INT_MAX : count, fdt->cursor);
+    if(totalBytesRead < 0){
+      return -1;
+    }
+    if(totalBytesRead == 0 && count > 0){
+      printf("Asking to read past the end of the file\n");
+    }
+    
+    //Increase cursor count 
+    fdt->cursor += totalBytesRead;
+    return totalBytesRead;
+  }
+  else{
+    printf("File wasn't opened in read mode\n");
+    return -1;
+  }
+}
+
+/*
+ * int bv_pread(int bvfs_FD, void *buf, size_t count, int offset);
+ *
+ * Same as bv_read but reads from offset instead of the cursor, which
+ * doesn't move.
+ *
+ * Input Parameters
+ *   bvfs_FD: The identifier for the file to read from.
+ *   buf: The buffer that the data will be read into.
+ *   count: The number of bytes to read.
+ *   offset: Where in the file to start.
+ *
+ * Return Value
+ *   int: >=0 the number of bytes read - short (or 0) at the end of the file.
+ *        -1 if some kind of failure occurred (eg. the file isn't open for
+ *           reading, or offset is negative). Also, print a meaningful error
+ *           to stderr prior to returning.
+ */
+int bv_pread(int bvfs_FD, void *buf, size_t count, int offset) {
+  fdTable *fdt = getFD(bvfs_FD);
+  if(fdt == NULL || !canRead(fdt) || offset < 0){
+    printf("File is not open for reading at %d\n", offset);
+    return -1;
+  }
+  settleStage(bvfs_FD);
+  return fileRead(fdt, (char*)buf, (count > (size_t)INT_MAX) ? INT_MAX : count, offset);
+}
+
+/*
+ * int bv_pwrite(int bvfs_FD, const void *buf, size_t count, int offset);
+ *
+ * Same as bv_write but writes at offset instead of the cursor, which doesn't
+ * move. Bytes inside the file are overwritten in place, and writing past the
+ * end fills the gap with zeros. Nothing is staged.
+ *
+ * Input Parameters
+ *   bvfs_FD: The identifier for the file to write to.
+ *   buf: The buffer containing the data to write.
+ *   count: The number of bytes to write.
+ *   offset: Where in the file to start.
+ *
+ * Return Value
+ *   int: >=0 the number of bytes written.
+ *        -1 if some kind of failure occurred (eg. the file isn't open for
+ *           writing, offset is negative, or the write would end past INT_MAX
+ *           bytes). Also, print a meaningful error to stderr prior to returning.
+ */
+int bv_pwrite(int bvfs_FD, const void *buf, size_t count, int offset) {
+  fdTable *fdt = getFD(bvfs_FD);
+  if(fdt == NULL || fdt->mode == BV_RDONLY || offset < 0){
+    printf("File is not open for writing at %d\n", offset);
+    return -1;
+  }
+  if(pastFileLimit(offset, count)){
+    return -1;
+  }
+  //anything staged lands first in case the two overlap
+  lockMutex(&stageLocks[bvfs_FD]);
+  int ret = flushStage(fdt, 1);
+  if(ret == 0){
+    ret = fileWrite(fdt->inode, offset, (const char*)buf, count, 0);
+  }
+  unlockMutex(&stageLocks[bvfs_FD]);
+  return ret;
+}
+
+// Available origins for bv_lseek
+int BV_SEEK_SET = 0;
+int BV_SEEK_CUR = 1;
+int BV_SEEK_END = 2;
+
+/*
+ * int bv_lseek(int bvfs_FD, int offset, int whence);
+ *
+ * Moves the cursor of the file to offset bytes from the start of the file
+ * (BV_SEEK_SET), the cursor (BV_SEEK_CUR) or the end of the file
+ * (BV_SEEK_END). A writer can seek past the end - the next write fills the
+ * gap with zeros. Staged writes are written out first.
+ *
+ * Input Parameters
+ *   bvfs_FD: The identifier for the file.
+ *   offset: How far to move.
+ *   whence: Where to move from.
+ *
+ * Return Value
+ *   int: >=0 the new cursor.
+ *        -1 if some kind of failure occurred (eg. the file isn't open, or
+ *           the cursor would go before the start of the file or past INT_MAX,
+ *           the largest a file can be). Also, print a meaningful error to
+ *           stderr prior to returning.
+ */
+int bv_lseek(int bvfs_FD, int offset, int whence) {
+  fdTable *fdt = getFD(bvfs_FD);
+  if(fdt == NULL){
+    printf("File is not open\n");
+    return -1;
+  }
+  lockMutex(&stageLocks[bvfs_FD]);
+  flushStage(fdt, 1);
+  int base = fdt->cursor;
+  if(whence == BV_SEEK_SET){
+    base = 0;
+  }else if(whence == BV_SEEK_END){
+    //the end is past any async write still in flight
+    readLock(&getSlot(fdt->inode)->lock);
+    base = getInode(fdt->inode)->numBytes;
+    if(getSlot(fdt->inode)->aioEnd > base){
+      base = getSlot(fdt->inode)->aioEnd;
+    }
+    unlockRW(&getSlot(fdt->inode)->lock);
+  }else if(whence != BV_SEEK_CUR){
+    base = -1;
+    offset = 0;
+  }
+  //the cursor can't go before the start or past the largest file (INT_MAX bytes) - checked
+  //before base + offset is worked out so it can't overflow
+  if(base < 0 || offset < -base || (offset > 0 && offset > INT_MAX - base)){
+    unlockMutex(&stageLocks[bvfs_FD]);
+    printf("Can't seek there\n");
+    return -1;
+  }
+  fdt->cursor = base + offset;
+  unlockMutex(&stageLocks[bvfs_FD]);
+  return fdt->cursor;
+}
+
+/*
+ * int bv_unlink(const char* fileName);
+ *
+ * This function is intended to delete a file that has been allocated within
+ * the bvfs file system.
+ *
+ * Input Parameters
+ *   fileName: A c-string representing the path of the file you wish to
+ *             delete from the bvfs file system. Directories go with bv_rmdir.
+ *
+ * Return Value
+ *   int:  0 if the delete succeeded.
+ *        -1 if some kind of failure occurred (eg. the file does not exist).
+ *           Also, print a meaningful error to stderr prior to returning.
+ */
+int bv_unlink(const char* fileName) {
+  char key[FILE_NAME_SIZE];
+  writeLock(&nameLock);
+  int dir = resolvePath(fileName, key);
+  int id = (dir == -1) ? -1 : dirLookup(dir, key);
+
+  //we didn't have that filename - so return -1
+  if(id == -1){
+    unlockRW(&nameLock);
+    printf("couldn't find that file to delete\n");
+    return -1;
+  }
+  if(getInode(id)->isDir){
+    unlockRW(&nameLock);
+    printf("%s is a directory - use bv_rmdir\n", fileName);
+    return -1;
+  }
+  //the name goes away now
+  dirRemove(dir, key);
+  num_files--;
+
+  //still open - its blocks are freed on the last bv_close
+  lockMutex(&fdLock);
+  if(getSlot(id)->openCount > 0){
+    getSlot(id)->unlinked = 1;
+    unlockMutex(&fdLock);
+    unlockRW(&nameLock);
+    return 0;
+  }
+  unlockMutex(&fdLock);
+
+  //"free" all the blocks it had and set the iNode back to unused state
+  releaseInode(id);
+  unlockRW(&nameLock);
+  logCommit();
+  return 0;
+}
+
+/*
+ * int bv_mkdir(const char *path);
+ *
+ * Makes a new, empty directory. Its entries are kept in a B+tree, one node
+ * per block of the directory, sorted by name - finding a name costs one
+ * binary search per level however big the directory gets. Nodes are held in
+ * memory while mounted and logged to the journal like the iNodes.
+ *
+ * Input Parameters
+ *   path: A c-string with the path of the new directory. Every directory
+ *         before the last name has to exist already.
+ *
+ * Return Value
+ *   int:  0 if the directory was made.
+ *        -1 if it couldn't be (eg. something already has that path, or there
+ *           are no iNodes left). Also, print a meaningful error to stderr
+ *           prior to returning.
+ */
+int bv_mkdir(const char *path) {
+  char key[FILE_NAME_SIZE];
+  writeLock(&nameLock);
+  int dir = resolvePath(path, key);
+  if(dir == -1){
+    unlockRW(&nameLock);
+    return -1;
+  }
+  if(dirLookup(dir, key) != -1){
+    unlockRW(&nameLock);
+    printf("%s already exists\n", path);
+    return -1;
+  }
+  int id = nextInode();
+  if(id == -1){
+    unlockRW(&nameLock);
+    return -1;
+  }
+  if(dirInsert(dir, key, id) == -1){
+    unlockRW(&nameLock);
+    printf("No room left for the directory entry\n");
+    return -1;
+  }
+  numFreeInodes--;
+
+  //no blocks until it gets its first entry
+  readLock(&metaLock);
+  writeLock(&getSlot(id)->lock);
+  getInode(id)->time = time(NULL);
+  getInode(id)->numBytes = 0;
+  getInode(id)->isDir = 1;
+  getInode(id)->isInline = 0;
+  touchInode(id);
+  unlockRW(&getSlot(id)->lock);
+  unlockRW(&metaLock);
+  num_dirs++;
+  unlockRW(&nameLock);
+  logCommit();
+  return 0;
+}
+
+/*
+ * int bv_rmdir(const char *path);
+ *
+ * Removes an empty directory and gives its blocks back.
+ *
+ * Input Parameters
+ *   path: A c-string with the path of the directory to remove.
+ *
+ * Return Value
+ *   int:  0 if the directory was removed.
+ *        -1 if it wasn't (eg. it doesn't exist, isn't a directory or isn't
+ *           empty). Also, print a meaningful error to stderr prior to
+ *           returning.
+ */
+int bv_rmdir(const char *path) {
+  char key[FILE_NAME_SIZE];
+  writeLock(&nameLock);
+  int dir = resolvePath(path, key);
+  int id = (dir == -1) ? -1 : dirLookup(dir, key);
+  if(id == -1 || !getInode(id)->isDir){
+    unlockRW(&nameLock);
+    printf("couldn't find that directory to remove\n");
+    return -1;
+  }
+  if(!dirEmpty(id)){
+    unlockRW(&nameLock);
+    printf("%s isn't empty\n", path);
+    return -1;
+  }
+  dirRemove(dir, key);
+  num_dirs--;
+  releaseInode(id);
+  unlockRW(&nameLock);
+  logCommit();
+  return 0;
+}
+
+//function to fill st in for iNode id listed under name. caller holds nameLock
+void fillStat(int id, const char *name, bvStat *st){
+  memcpy(st->name, name, FILE_NAME_SIZE);
+  readLock(&getSlot(id)->lock);
+  iNode *curr = getInode(id);
+  st->size = curr->numBytes;
+  st->mtime = curr->time;
+  st->isDir = curr->isDir;
+  //every block held - a directory's tree nodes, used or not, or a file's data plus its
+  //extent block if it has one. an inline file takes none
+  st->blocks = curr->numBlocks + (curr->extentBlock != 0);
+  unlockRW(&getSlot(id)->lock);
+}
+
+//function to print every entry under node n of a directory in name order - path holds
+//the directory's path (len characters) and subdirectories are listed where they fall
+//caller holds nameLock
+void lsNode(int dir, int n, char *path, int len){
+  dirNode *node = getNode(dir, n);
+  for(int i=0; i<node->count; i++){
+    dirEntry *ent = &nodeEntries(node)[i];
+    if(!node->leaf){
+      lsNode(dir, ent->inode, path, len);
+      continue;
+    }
+    iNode *curr = getInode(ent->inode);
+    char timeStr[32];
+    int end = len + snprintf(path + len, MAX_PATH - len, "%s", ent->name);
+    if(curr->isDir){
+      printf("| directory, %.24s, %s/\n", ctime_r(&(curr->time), timeStr), path);
+      if(getSlot(ent->inode)->tree.numNodes > 0){
+        path[end] = '/';
+        lsNode(ent->inode, 0, path, end + 1);
+      }
+    }else{
+      bvStat st;
+      fillStat(ent->inode, ent->name, &st);
+      printf("| bytes: %d, blocks: %d, %.24s, %s\n", st.size, st.blocks, ctime_r(&st.mtime, timeStr), path);
+    }
+  }
+}
+
+/*
+ * void bv_ls();
+ *
+ * This function will list the contests of the file system.
+ * First, you must print out a header that declares how many files live within
+ * the file system. See the example below in which we print "2 Files" up top.
+ * Then display the following information for each file listed:
+ *   1) the file size in bytes
+ *   2) the number of blocks occupied within bvfs
+ *   3) the time and date of last modification (derived from unix timestamp)
+ *   4) the name of the file.
+ * An example of such output appears below:
+ *    | 2 Files
+ *    | bytes:  276, blocks: 1, Tue Nov 14 09:01:32 2017, bvfs.h
+ *    | bytes: 1998, blocks: 4, Tue Nov 14 10:32:02 2017, notes.txt
+ *
+ * Entries come in name order with their full path. A directory gets a line
+ * of its own (with a trailing '/') followed by everything in it, and the
+ * header counts directories too once there are any ("3 Files, 1 Directory").
+ * bv_stat and bv_readdir hand back the same details without printing them.
+ *
+ * Hint: #include <time.h>
+ * Hint: time_t now = time(NULL); // gets the current unix timestamp (32 bits)
+ * Hint: printf("%s\n", ctime(&now));
+ *
+ * Input Parameters
+ *   None
+ *
+ * Return Value
+ *   void
+ */
+void bv_ls() {
+  readLock(&nameLock);
+  if(num_dirs == 0){
+    printf("| %d Files\n", num_files);
+  }else{
+    printf("| %d Files, %d %s\n", num_files, num_dirs, (num_dirs == 1) ? "Directory" : "Directories");
+  }
+  if(getSlot(ROOT_INODE)->tree.numNodes > 0){
+    char path[MAX_PATH];
+    lsNode(ROOT_INODE, 0, path, 0);
+  }
+  unlockRW(&nameLock);
+}
 
-//function to remove blocks from an iNodes diskmap - put them back in super block
-void removeDiskMap(iNode* file){
-  int SPNEXT = SUPERPTR;
-  
-  //set head to begining of freed blocks
-  SUPERPTR = file->blockAddresses[0];
-  lseek(pFD, 0, SEEK_SET);
-  write(pFD, (void*)&SUPERPTR, sizeof(short));
-  
-  //link blocks in iNode together
-  for(int i=0; i<file->numBlocks-1; i++){
-    //Seek to one of the file blocks (blockAddresses[i])
-    lseek(pFD, (BLOCK_SIZE * file->blockAddresses[i]), SEEK_SET);
-    //Write blockAddresses[i+1] to the block we seeked to 
-    write(pFD, (void *)&(file->blockAddresses[i+1]), sizeof(short));
-  }
-  
-  //set end of now free blocks to the rest of the super block list
-  lseek(pFD, (BLOCK_SIZE * file->blockAddresses[file->numBlocks-1]), SEEK_SET);
-  write(pFD, (void *)&SPNEXT, sizeof(short));
-}
-
-//function to get the next free block and take it out of the super block list - returns block that is "theirs" to write to 
-short getSuperBlock(){
-  //No super blocks left
-  if(SUPERPTR == 16385){ 
-    return -1;
-  }
-  
-  short val = SUPERPTR;
-  short tmp;
-  
-  //seek to next free block - put it in tmp
-  lseek(pFD,  SUPERPTR * BLOCK_SIZE, SEEK_SET);
-  read(pFD, (void *)&tmp, sizeof(short));
-  
-  //Seek to beginning and reset Head ptr
-  lseek(pFD, 0, SEEK_SET);
-  write(pFD, (void*)&tmp, sizeof(short));
-  
-  //set SUPER global and return
-  SUPERPTR = tmp;
-  return val;  
+//function to find the directory a path names - "" or "/" is the root
+//returns its iNode, or -1 (after saying why). caller holds nameLock
+int resolveDir(const char *path){
+  const char *name = path;
+  while(*name == '/'){
+    name++;
+  }
+  if(*name == '\0'){
+    return ROOT_INODE;
+  }
+  char key[FILE_NAME_SIZE];
+  int dir = resolvePath(path, key);
+  int id = (dir == -1) ? -1 : dirLookup(dir, key);
+  if(id == -1 || !getInode(id)->isDir){
+    printf("No directory %s\n", path);
+    return -1;
+  }
+  return id;
 }
 
-//helper function to load data structures we use from disk into memory
-void buildMemStructs(int id){
-  //seek to begining of partition - posistion of super block
-  lseek(id, 0, SEEK_SET);
-  //Read super block ptr
-  read(id, (void*)&SUPERPTR, sizeof(short));
-  //Seek to second block
-  lseek(id, (BLOCK_SIZE -sizeof(short)), SEEK_CUR);
-  //Read iNodes from Disk
-  for(int i=0; i<256; i++){
-    iNode *newNode =(iNode *) malloc(sizeof(iNode));
-    read(id, (void*)newNode, sizeof(iNode));
-    lseek(id, (BLOCK_SIZE - sizeof(iNode)), SEEK_CUR); 
-    iNodeArray[i] = newNode;
-    
-    //malloc and intialize filedescriptors
-    fdTable *fd = (fdTable *) malloc(sizeof(fdTable));
-    fd->mode = -1;
-    fd->cursor = 0;
-    fd->isOpen = 0;
-    fdtArr[i] = fd;
+//function to fill entries with the names under node n of a directory that sort after key
+//(zero padded), in name order, stopping at max. returns how many it filled. caller holds nameLock
+int readdirNode(int dir, int n, const char *key, bvStat *entries, int max){
+  dirNode *node = getNode(dir, n);
+  dirEntry *ents = nodeEntries(node);
+  int filled = 0;
+  if(!node->leaf){
+    //children before the one key falls in hold nothing after it
+    for(int i=nodeChild(node, key); i<node->count && filled<max; i++){
+      filled += readdirNode(dir, ents[i].inode, key, entries + filled, max - filled);
+    }
+    return filled;
+  }
+  for(int i=nodeSearch(node, key)+1; i<node->count && filled<max; i++){
+    fillStat(ents[i].inode, ents[i].name, &entries[filled++]);
   }
+  return filled;
 }
 
 /*
- * int bv_init(const char *fs_fileName);
- *
- * Initializes the bvfs file system based on the provided file. This file will
- * contain the entire stored file system. Invocation of this function will do
- * one of two things:
- *
- *   1) If the file (fs_fileName) exists, the function will initialize in-memory
- *   data structures to help manage the file system methods that may be invoked.
+ * int bv_stat(const char *path, bvStat *st);
  *
- *   2) If the file (fs_fileName) does not exist, the function will create that
- *   file as the representation of a new file system and initialize in-memory
- *   data structures to help manage the file system methods that may be invoked.
+ * Looks up one file or directory and fills st in with its name, size in bytes,
+ * the blocks it holds, its last modification time and whether it is a
+ * directory - what bv_ls prints, without the printing.
  *
  * Input Parameters
- *   fs_fileName: A c-string representing the file on disk that stores the bvfs
- *   file system data.
+ *   path: The file or directory, names separated by '/' as for bv_open -
+ *         "" or "/" for the root, which is reported under the name "/".
+ *   st: Where the answer goes.
  *
  * Return Value
- *   int:  0 if the initialization succeeded.
- *        -1 if the initialization failed (eg. file not found, access denied,
- *           etc.). Also, print a meaningful error to stderr prior to returning.
+ *   int:  0 if st was filled in.
+ *        -1 if some kind of failure occurred (eg. there is nothing by that
+ *           name). Also, print a meaningful error to stderr prior to
+ *           returning.
  */
-int bv_init(const char *fs_fileName) {
-
-  pFD = open(fs_fileName, O_CREAT | O_RDWR | O_EXCL, 0644);
-  if (pFD < 0) {
-    if (errno == EEXIST) {
-      // File already exists. Open it and read info (integer) back
-      pFD = open(fs_fileName, O_CREAT | O_RDWR , S_IRUSR | S_IWUSR);
-      //read files from 
-      buildMemStructs(pFD);
-
-    }
-    else {
-      // Something bad must have happened... check errno?
-      fprintf(stderr, "%s", strerror(errno));
-      return -1;
-    }
-
-  } else {
-    // File did not previously exist
-    //write 2 bytes for first superBlock ptr
-    short temp = 257;
-    write(pFD, (void*)&temp, sizeof(short));
-    //seek to next block
-    lseek(pFD, 510, SEEK_CUR);
-
-    //write inodes
-    iNode node;
-    for(int i=0; i<256; i++){
-      bzero(&node, sizeof(node));
-      node.numBytes = -1;
-
-      //write it to file
-      write(pFD, (void*)&node, sizeof(iNode));
-
-      //seek to next iNode location
-      lseek(pFD, 512 - sizeof(iNode), SEEK_CUR); 
-    }
-
-    //write remaining superBlock pointers - 2 bytes pointing to the next free block
-    for(int i=257; i<16384; i++){
-      //write short of next free block (very next block in this case)
-      int j=i+1;
-      write(pFD, (void*)&j, sizeof(short));
-      //seek to the next block
-      lseek(pFD, 510, SEEK_CUR);
-    }
-
-    //set up all data structures in memory
-    buildMemStructs(pFD);
-   
-    //intialize numBytes for every iNode - its used to check if that iNode is assigned a file
-    for(int i=0; i<256; i++){
-      iNodeArray[i]->numBytes = -1;
-    }
+int bv_stat(const char *path, bvStat *st) {
+  char key[FILE_NAME_SIZE];
+  readLock(&nameLock);
+  //"" or "/" is the root - it isn't listed under any name, so it goes as "/"
+  const char *name = path;
+  while(*name == '/'){
+    name++;
+  }
+  int id;
+  if(*name == '\0'){
+    bzero(key, FILE_NAME_SIZE);
+    key[0] = '/';
+    id = ROOT_INODE;
+  }else{
+    int dir = resolvePath(path, key);
+    id = (dir == -1) ? -1 : dirLookup(dir, key);
+  }
+  if(id == -1){
+    unlockRW(&nameLock);
+    printf("couldn't find %s\n", path);
+    return -1;
   }
+  fillStat(id, key, st);
+  unlockRW(&nameLock);
+  return 0;
 }
 
-
 /*
- * int bv_destroy();
+ * int bv_readdir(const char *path, bvDirCursor *cursor, bvStat *entries, int max);
  *
- * This is your opportunity to free any dynamically allocated resources and
- * perhaps to write any remaining changes to disk that are necessary to finalize
- * the bvfs file before exiting.
+ * Lists a directory a batch at a time. entries is filled with up to max of
+ * its names, in name order, each as bv_stat would report it. The listing
+ * starts after the name in cursor (a zeroed cursor starts at the beginning)
+ * and cursor is moved on to the last name filled in, so calling again with
+ * the same cursor carries on where this left off. A name created or removed
+ * between calls shows up, or doesn't, by where it sorts - nothing is listed
+ * twice or skipped.
+ *
+ * Subdirectories are listed as entries of their own, not descended into.
+ * Each call goes down the directory's tree once to find where to start then
+ * reads on in memory - nothing is formatted or allocated.
+ *
+ * Input Parameters
+ *   path: The directory to list - "" or "/" for the root.
+ *   cursor: Where the listing is up to.
+ *   entries: Where the names go.
+ *   max: The size of entries.
  *
  * Return Value
- *   int:  0 if the clean-up process succeeded.
- *        -1 if the clean-up process failed (eg. bv_init was not previously,
- *           called etc.). Also, print a meaningful error to stderr prior to
- *           returning.
+ *   int: >=0 the number of entries filled in - 0 once the directory has been
+ *           listed to the end.
+ *        -1 if some kind of failure occurred (eg. path isn't a directory).
+ *           Also, print a meaningful error to stderr prior to returning.
  */
-int bv_destroy() {
-  iNode *node;
-  //seek past first superblock
-  lseek(pFD, BLOCK_SIZE, SEEK_SET);
-  //write iNodes to disk
-  for(int i=0; i<256; i++){
-    node = iNodeArray[i];
-    write(pFD, (void*)node, sizeof(iNode));
-    lseek(pFD, 512 - sizeof(iNode), SEEK_CUR);
+int bv_readdir(const char *path, bvDirCursor *cursor, bvStat *entries, int max) {
+  readLock(&nameLock);
+  int dir = resolveDir(path);
+  if(dir == -1){
+    unlockRW(&nameLock);
+    return -1;
   }
-
-  //free fdTABLE and iNodes
-  for(int i=0; i<256; i++){
-    free(iNodeArray[i]);
-    free(fdtArr[i]);
+  int filled = 0;
+  if(max > 0 && getSlot(dir)->tree.numNodes > 0){
+    filled = readdirNode(dir, 0, cursor->after, entries, max);
   }
+  if(filled > 0){
+    memcpy(cursor->after, entries[filled-1].name, FILE_NAME_SIZE);
+  }
+  unlockRW(&nameLock);
+  return filled;
+}
 
-  //close file descriptor
-  close(pFD);
+//function to get a free async request slot for tag - returns -1 if every slot is
+//waiting to be reaped. caller holds ringLock
+int aioStart(void *tag){
+  if(numFreeAio == 0){
+    return -1;
+  }
+  int r = freeAio[--numFreeAio];
+  aioReqs[r].tag = tag;
+  aioReqs[r].result = 0;
+  aioReqs[r].pending = 0;
+  aioReqs[r].failed = 0;
+  return r;
 }
 
-// Available Modes for bvfs (see bv_open below)
-int BV_RDONLY = 0;
-int BV_WCONCAT = 1;
-int BV_WTRUNC = 2;
+//function to queue every segment of request r on the ring - a request with nothing
+//to transfer (or no ring) finishes right away with result. caller holds ringLock
+void aioQueue(int r, ioSeg *segs, int n, int isWrite, int result){
+  if(ringFD == -1 || n == 0){
+    aioReqs[r].result = result;
+    aioReqs[r].failed = (result < 0);
+    aioFinish(r);
+    return;
+  }
+  aioReqs[r].pending = n;
+  for(int i=0; i<n; i++){
+    ringQueue(r, &segs[i], isWrite);
+  }
+}
 
 /*
- * int bv_open(const char *fileName, int mode);
+ * int bv_read_async(int bvfs_FD, void *buf, size_t count, void *tag);
  *
- * This function is intended to open a file in either read or write mode. The
- * above modes identify the method of access to utilize. If the file does not
- * exist, you will create it. The function should return a bvfs file descriptor
- * for the opened file which may be later used with bv_(close/write/read).
+ * Starts reading count bytes from the cursor of the file into buf and moves
+ * the cursor past them straight away. The read is only queued - bv_submit
+ * (or bv_reap) sends every queued request to the kernel with one
+ * io_uring_enter, and bv_reap hands back tag once it has finished. buf
+ * belongs to the request until then. Without BV_URING the read happens
+ * before this returns and its completion waits for bv_reap. A read that
+ * runs into the end of the file completes short.
  *
  * Input Parameters
- *   fileName: A c-string representing the name of the file you wish to fetch
- *             (or create) in the bvfs file system.
- *   mode: The access mode to use for accessing the file
- *           - BV_RDONLY: Read only mode
- *           - BV_WCONCAT: Write only mode, appending to the end of the file
- *           - BV_WTRUNC: Write only mode, replacing the file and writing anew
+ *   bvfs_FD: The identifier for the file to read from.
+ *   buf: The buffer that the data will be read into.
+ *   count: The number of bytes to read.
+ *   tag: Anything - handed back with the completion.
  *
  * Return Value
- *   int: >=0 Greater-than or equal-to zero value representing the bvfs file
- *           descriptor on success.
- *        -1 if some kind of failure occurred. Also, print a meaningful error to
- *           stderr prior to returning.
+ *   int:  0 if the read was queued.
+ *        -1 if it couldn't be (the file isn't open for reading, or MAX_AIO
+ *           requests are waiting to be reaped). Also, print a meaningful
+ *           error to stderr prior to returning.
  */
-int bv_open(const char *fileName, int mode) {
-  if(strlen(fileName) >= 31){
-    printf("Filename to long\n");
-    return -1;
-  }
-  if(mode > 2 || mode < 0){
-    printf("Invalid  Mode\n");
+int bv_read_async(int bvfs_FD, void *buf, size_t count, void *tag) {
+  fdTable *fdt = getFD(bvfs_FD);
+  if(fdt == NULL || !canRead(fdt)){
+    printf("File is not open for reading\n");
     return -1;
   }
-
-  //check if we need to create the file or not
-  iNode *file = NULL;
-  fdTable *fdt = NULL;
-  for(int i=0; i<256; i++){
-    if(!strcmp(iNodeArray[i]->name, fileName) && iNodeArray[i]->numBytes != -1){
-      //found a file with that name
-      file = iNodeArray[i];
-      fdt = fdtArr[i];
-      //check if the file is already open 
-      if(fdt->isOpen == 1){
-        printf("File is already open\n");
-        return -1;
-      }
-      //set up file descriptor
-      fdt->isOpen = 1;
-      fdt->mode = mode;
-      //check file mode      
-      if(mode == BV_WCONCAT){
-        //concat - set cursor to end of that file
-        fdt->cursor = iNodeArray[i]->numBytes; 
-      }
-      else if(mode == BV_WTRUNC){
-        //truncate - erase all data (and blocks) set cursor to 0
-        removeDiskMap(iNodeArray[i]);
-        fdt->cursor = 0;
-      }
-      else{
-        //else it is a read so set cursor to 0
-        fdt->cursor = 0;
-      }
-      //add it to the array
-      fdtArr[i] = fdt;
-      //return fileDescriptor id of sorts - just its posistion in the array
-      return i; 
+  settleStage(bvfs_FD);
+  if(ringFD == -1){
+    //no ring - do it now and leave the completion for bv_reap
+    lockMutex(&ringLock);
+    int r = aioStart(tag);
+    unlockMutex(&ringLock);
+    if(r == -1){
+      printf("Too many async requests waiting to be reaped\n");
+      return -1;
     }
+    int done = bv_read(bvfs_FD, buf, count);
+    lockMutex(&ringLock);
+    aioQueue(r, NULL, 0, 0, done);
+    unlockMutex(&ringLock);
+    return 0;
   }
 
-  //if it gets this far the file doesn't exist
-  if(mode == BV_RDONLY){
-    //cant open a new file to read from
-    printf("Tried to read a file that deosn't exist\n");
-    return -1;
+  int id = fdt->inode;
+  readLock(&getSlot(id)->lock);
+  //stops at the end of the file
+  int left = getInode(id)->numBytes - fdt->cursor;
+  if(left < 0 || count > (size_t)left){
+    count = (left > 0) ? left : 0;
   }
-  if(num_files < 256){
-    //file doesn't exist so make it
-    for(int j=0; j<256; j++){
-      //get first unused iNode
-      if(iNodeArray[j]->numBytes == -1){
-        //setting file name
-        strcpy(iNodeArray[j]->name, fileName);
-        //set up iNode including its time
-        iNodeArray[j]->time = time(NULL);
-        iNodeArray[j]->numBytes = 0;
-        //set up file descriptor
-        fdtArr[j]->isOpen = 1;
-        fdtArr[j]->mode = mode;
-        fdtArr[j]->cursor = 0;
-        num_files ++;
-        
-        return j;
-      }
+  ioSeg segs[MAX_EXTENTS];
+  int numSegs = 0;
+  int copied = 0;
+  if(getInode(id)->isInline){
+    //an inline file has nothing on disk for the ring to read - it completes now
+    if(count > 0){
+      memcpy(buf, getInode(id)->data + fdt->cursor, count);
     }
+    copied = count;
+  }else{
+    numSegs = planIO(id, fdt->cursor, count, (char*)buf, segs);
+    //the ring reads the disk directly - anything newer is still in the cache
+    cacheSettle(segs, numSegs, 0);
   }
-  else{
-    //else there are 256 other files so we hit the max
-    printf("Too many files already exist - hit maximum\n");
+
+  lockMutex(&ringLock);
+  int r = aioStart(tag);
+  if(r != -1){
+    aioQueue(r, segs, numSegs, 0, copied);
+  }
+  unlockMutex(&ringLock);
+  unlockRW(&getSlot(id)->lock);
+  if(r == -1){
+    printf("Too many async requests waiting to be reaped\n");
     return -1;
   }
+  fdt->cursor += count;
+  return 0;
 }
 
 /*
- * int bv_close(int bvfs_FD);
+ * int bv_write_async(int bvfs_FD, const void *buf, size_t count, void *tag);
  *
- * This function is intended to close a file that was previously opened via a
- * call to bv_open. This will allow you to perform any finalizing writes needed
- * to the bvfs file system.
+ * Starts writing count bytes from buf at the cursor of the file, the way
+ * bv_read_async starts a read. Blocks are allocated and the cursor moves
+ * straight away, and the data goes around the buffer cache. The file only
+ * grows to cover the write once it has finished - when bv_reap hands it back,
+ * or sooner if the file has to be settled: bv_write, bv_close, BV_WTRUNC and
+ * bv_unlink wait for writes still in flight first, so their blocks can't be
+ * given to another file under them. A read of the range before then can see
+ * the old bytes or the new ones. Reap a write before bv_fsync if it has to be
+ * durable.
  *
  * Input Parameters
- *   fileName: A c-string representing the name of the file you wish to fetch
- *             (or create) in the bvfs file system.
+ *   bvfs_FD: The identifier for the file to write to.
+ *   buf: The buffer containing the data to write.
+ *   count: The number of bytes to write.
+ *   tag: Anything - handed back with the completion.
  *
  * Return Value
- *   int:  0 if open succeeded.
- *        -1 if some kind of failure occurred (eg. the file was not previously
- *           opened via bv_open). Also, print a meaningful error to stderr
- *           prior to returning.
+ *   int:  0 if the write was queued.
+ *        -1 if it couldn't be (the file isn't open for writing, the write
+ *           would end past INT_MAX bytes, or MAX_AIO requests are waiting to
+ *           be reaped). Also, print a meaningful error to stderr prior to
+ *           returning.
  */
-int bv_close(int bvfs_FD) {
-  //check if file exits - if not return -1
-  if(fdtArr[bvfs_FD]->isOpen == 0){
-    printf("File is not open\n");
+int bv_write_async(int bvfs_FD, const void *buf, size_t count, void *tag) {
+  fdTable *fdt = getFD(bvfs_FD);
+  if(fdt == NULL || fdt->mode == BV_RDONLY){
+    printf("File is not open for writing\n");
     return -1;
   }
-  //file doesnt exist
-  if(iNodeArray[bvfs_FD]->numBytes == -1){
-    printf("File doesn't exist\n");
+  if(pastFileLimit(fdt->cursor, count)){
     return -1;
   }
-  else{
-    //Reset the file descriptor
-    fdtArr[bvfs_FD]->mode = -1;
-    fdtArr[bvfs_FD]->cursor = 0;
-    fdtArr[bvfs_FD]->isOpen = 0;
-    
+  lockMutex(&ringLock);
+  int r = aioStart(tag);
+  unlockMutex(&ringLock);
+  if(r == -1){
+    printf("Too many async requests waiting to be reaped\n");
+    return -1;
+  }
+  //only this descriptor writes the file, so it's the only one that can make it stop being inline
+  if(ringFD == -1 || (getInode(fdt->inode)->isInline && fdt->cursor + count <= (size_t)INLINE_DATA)){
+    //no ring (or an inline file that stays inline, which only has to be copied into its iNode)
+    //do it now and leave the completion for bv_reap
+    int done = bv_write(bvfs_FD, buf, count);
+    lockMutex(&ringLock);
+    aioQueue(r, NULL, 0, 1, done);
+    unlockMutex(&ringLock);
+    return 0;
+  }
+
+  //staged writes land ahead of this one
+  lockMutex(&stageLocks[bvfs_FD]);
+  int staged = flushStage(fdt, 1);
+  unlockMutex(&stageLocks[bvfs_FD]);
+  if(staged != 0){
+    lockMutex(&ringLock);
+    aioQueue(r, NULL, 0, 1, -1);
+    unlockMutex(&ringLock);
+    return 0;
+  }
+
+  int id = fdt->inode;
+  readLock(&metaLock);
+  writeLock(&getSlot(id)->lock);
+  //an inline file this outgrows moves its bytes out to a block first
+  if(getInode(id)->isInline && spillInline(id) != 0){
+    unlockRW(&getSlot(id)->lock);
+    unlockRW(&metaLock);
+    printf("NO BLOCKS LEFT\n");
+    lockMutex(&ringLock);
+    aioQueue(r, NULL, 0, 1, 0);
+    unlockMutex(&ringLock);
     return 0;
   }
+  int cursor = fdt->cursor;
+  int room = growFile(id, cursor + count) - cursor;
+  if(room < (int)count){
+    printf("NO BLOCKS LEFT\n");
+    count = (room > 0) ? room : 0;
+  }
+  //after a seek past the end - the gap goes through the cache, and cacheSettle sends it on
+  //the file already ends after the writes still in flight, so only what's past them is a gap
+  int end = getInode(id)->numBytes;
+  if(getSlot(id)->aioEnd > end){
+    end = getSlot(id)->aioEnd;
+  }
+  if(count > 0 && cursor > end){
+    //zeroing can share a block with the last write in flight - it has to land first
+    aioSettle(id);
+    end = getInode(id)->numBytes;
+    zeroRange(id, end, cursor - end);
+  }
+  ioSeg segs[MAX_EXTENTS];
+  int numSegs = planIO(id, cursor, count, (char*)buf, segs);
+  //cached copies of these blocks would go stale
+  cacheSettle(segs, numSegs, 1);
+  fdt->cursor += count;
+
+  //the size and time wait for the write to finish - its blocks stay with the file until then
+  //since nothing trims or frees them without settling it first
+  lockMutex(&ringLock);
+  if(count > 0){
+    aioReqs[r].inode = id;
+    aioReqs[r].end = cursor + count;
+    aioReqs[r].count = count;
+    getSlot(id)->aioWrites++;
+    if(cursor + (int)count > getSlot(id)->aioEnd){
+      getSlot(id)->aioEnd = cursor + count;
+    }
+  }
+  aioQueue(r, segs, numSegs, 1, 0);
+  unlockMutex(&ringLock);
+  unlockRW(&getSlot(id)->lock);
+  unlockRW(&metaLock);
+  return 0;
 }
 
 /*
- * int bv_write(int bvfs_FD, const void *buf, size_t count);
+ * int bv_submit();
  *
- * This function will write count bytes from buf into a location corresponding
- * to the cursor of the file represented by bvfs_FD.
+ * Sends every queued async request to the kernel with one io_uring_enter.
+ *
+ * Return Value
+ *   int: the number of I/Os submitted (0 without BV_URING).
+ */
+int bv_submit() {
+  lockMutex(&ringLock);
+  int done = ringSubmit();
+  unlockMutex(&ringLock);
+  return (done < 0) ? 0 : done;
+}
+
+/*
+ * int bv_reap(bvCompletion *done, int max, int minWait);
+ *
+ * Submits anything still queued, then fills done with up to max finished
+ * async requests in the order they finished. Waits until at least minWait
+ * have finished (or nothing is left in flight).
  *
  * Input Parameters
- *   bvfs_FD: The identifier for the file to write to.
- *   buf: The buffer containing the data we wish to write to the file.
- *   count: The number of bytes we intend to write from the buffer to the file.
+ *   done: Where the completions go.
+ *   max: The size of done.
+ *   minWait: Completions to wait for - 0 only collects what is already done.
  *
  * Return Value
- *   int: >=0 Value representing the number of bytes written to the file.
- *        -1 if some kind of failure occurred (eg. the file is not currently
- *           opened via bv_open). Also, print a meaningful error to stderr
- *           prior to returning.
+ *   int: the number of completions put in done.
  */
-int bv_write(int bvfs_FD, const void *buf, size_t count) {
-  //checking if file is open
-  if(fdtArr[bvfs_FD]->isOpen == 0){
-    printf("File is not open %d\n",bvfs_FD); 
-    return -1;
-  }
-  //checking if their is a file for this fd
-  if(iNodeArray[bvfs_FD]->numBytes == -1){
-    printf("File Doesn't exist\n");
-    return -1;
-  }
-  //checking mode
-  if(fdtArr[bvfs_FD]->mode == BV_RDONLY){
-    printf("File opened in wrong mode\n");
-    return -1;
+int bv_reap(bvCompletion *done, int max, int minWait) {
+  lockMutex(&ringLock);
+  if(ringFD != -1){
+    ringSubmit();
+    ringHarvest(0);
+    while(aioDoneCount < minWait && aioDoneCount < max && ringInflight > 0){
+      ringHarvest(1);
+    }
   }
-  else{
-    //should be to the point where we can write 
-    
-    int bytesToWrite = count;
-    int totalBytesWritten = 0;  
-    while(bytesToWrite != 0){
-      //Create variables
-      int targetBlock = fdtArr[bvfs_FD]->cursor / BLOCK_SIZE;
-      int blockOffset = fdtArr[bvfs_FD]->cursor % BLOCK_SIZE;
-      int spaceLeft = BLOCK_SIZE-blockOffset; 
-      int bytesWritten = 0;
-      if(blockOffset == 0){
-        short newBlockID = getSuperBlock();
-        //Check if there are any blocks free
-        if(newBlockID == -1){
-          printf("NO BLOCKS LEFT\n");
-          return bytesWritten;
-        }
-        iNodeArray[bvfs_FD]->blockAddresses[targetBlock] = newBlockID;
-      }
-      //Seek to correct block
-      int offset = iNodeArray[bvfs_FD]->blockAddresses[targetBlock]; 
-      lseek(pFD, (offset*BLOCK_SIZE) + blockOffset, SEEK_SET);
-      
-      //Write bytes to the disk
-      if(bytesToWrite < spaceLeft){
-        bytesWritten = write(pFD, buf+totalBytesWritten, bytesToWrite);
-        
-      }else{
-        bytesWritten = write(pFD, buf+totalBytesWritten, spaceLeft);
-      }
-      //Update variables
-      totalBytesWritten += bytesWritten;
-      bytesToWrite -= bytesWritten;
-      fdtArr[bvfs_FD]->cursor += bytesWritten; 
+  int n = 0;
+  while(n < max && aioDoneCount > 0){
+    int r = aioDone[aioDoneHead];
+    int id = aioReqs[r].inode;
+    if(id != -1){
+      //a write's size goes on its file before the caller hears it finished - that takes the
+      //iNode lock, which comes before ringLock
+      unlockMutex(&ringLock);
+      readLock(&metaLock);
+      writeLock(&getSlot(id)->lock);
+      aioApply(id);
+      unlockRW(&getSlot(id)->lock);
+      unlockRW(&metaLock);
+      lockMutex(&ringLock);
+      continue;
     }
-    
-    //Update iNode with appropriate numBytes and timestamp
-    iNodeArray[bvfs_FD]->numBytes += totalBytesWritten;
-    iNodeArray[bvfs_FD]->time = time(NULL);
-    return totalBytesWritten;
+    aioDoneHead = (aioDoneHead + 1) % MAX_AIO;
+    aioDoneCount--;
+    done[n].tag = aioReqs[r].tag;
+    done[n].result = aioReqs[r].failed ? -1 : aioReqs[r].result;
+    n++;
+    freeAio[numFreeAio++] = r;
   }
+  unlockMutex(&ringLock);
+  return n;
 }
 
 /*
- * int bv_read(int bvfs_FD, void *buf, size_t count);
+ * int bv_read_view(int bvfs_FD, size_t count, bvSpan *spans, int maxSpans);
  *
- * This function will read count bytes from the location corresponding to the
- * cursor of the file (represented by bvfs_FD) to buf.
+ * Reads count bytes from the cursor of the file without copying them. spans
+ * is filled with read only pieces of the file, in order, that point straight
+ * into the mapped partition (BV_MMAP) or into pinned buffer cache blocks.
+ * A file small enough to live in its iNode has no blocks, so its bytes are
+ * copied once into a buffer the descriptor keeps. They stay valid until
+ * bv_release_view or bv_close on the descriptor.
+ *
+ * A view can come back shorter than count - the file ended, spans ran out, the
+ * descriptor holds its share of the cache (a quarter of it) pinned already, or
+ * it still holds a view of a small file's copy.
+ * The cursor only moves past what the spans cover, so call again for the
+ * rest, after a bv_release_view if nothing came back. Without BV_MMAP or a
+ * buffer cache there is nothing to point into and views aren't supported.
  *
  * Input Parameters
  *   bvfs_FD: The identifier for the file to read from.
- *   buf: Th/e buffer that we will write the data to.
- *   count: The number of bytes we intend to write to the buffer from the file.
+ *   count: The number of bytes to read.
+ *   spans: Where the pieces go.
+ *   maxSpans: The size of spans.
  *
  * Return Value
- *   int: >=0 Value representing the number of bytes written to buf.
- *        -1 if some kind of failure occurred (eg. the file is not currently
- *           opened via bv_open). Also, print a meaningful error to stderr
- *           prior to returning.
+ *   int: >=0 the number of spans filled in.
+ *        -1 if some kind of failure occurred (eg. the file isn't open for
+ *           reading). Also, print a meaningful error to stderr prior to
+ *           returning.
  */
-int bv_read(int bvfs_FD, void *buf, size_t count) {
-  //check if file is open
-  if(fdtArr[bvfs_FD]->isOpen == 0){
-    printf("File is not open\n");
+int bv_read_view(int bvfs_FD, size_t count, bvSpan *spans, int maxSpans) {
+  fdTable *fdt = getFD(bvfs_FD);
+  if(fdt == NULL || !canRead(fdt)){
+    printf("File is not open for reading\n");
     return -1;
   }
-  //check if file exists
-  if(iNodeArray[bvfs_FD]->numBytes == -1){
-    printf("File doesn't exist\n");
+  settleStage(bvfs_FD);
+  if(diskMap == NULL && cacheSize == 0){
+    printf("Read views need BV_MMAP or the buffer cache\n");
     return -1;
   }
-  //Asking to read more bytes than exist
-  if(fdtArr[bvfs_FD]->cursor + count >  iNodeArray[bvfs_FD]->numBytes){
-    printf("Asking to read more than the size of current file\n");
-    return -1;
+  int id = fdt->inode;
+  readLock(&getSlot(id)->lock);
+  //stops at the end of the file
+  int left = getInode(id)->numBytes - fdt->cursor;
+  if(left < 0 || count > (size_t)left){
+    count = (left > 0) ? left : 0;
   }
-  //check mode
-  if(fdtArr[bvfs_FD]->mode == BV_RDONLY){
-    //while theres still blocks to read
-    int bytesLeft = count;
-    int totalBytesRead =0;  
-    while(bytesLeft != 0){
-      //Variables -- we might not use them all
-      int bytesRead = 0;
-      int targetBlock = fdtArr[bvfs_FD]->cursor / BLOCK_SIZE;
-      int blockOffset = fdtArr[bvfs_FD]->cursor % BLOCK_SIZE;
-      int spaceLeft = BLOCK_SIZE-blockOffset; 
-      int offset = iNodeArray[bvfs_FD]->blockAddresses[targetBlock]; 
-      //Seek to new block
-      lseek(pFD, offset*BLOCK_SIZE+blockOffset, SEEK_SET); 
-      //If spaace left in current block read it all 
-      if(bytesLeft <= spaceLeft){
-        bytesRead += read(pFD, buf + totalBytesRead, bytesLeft);
-      }
-      //Not enough space left in current block reading what we can then
-      else{
-        bytesRead += read(pFD, buf + totalBytesRead,spaceLeft);
-      }
-      //Decrease the bytes left to read
-      bytesLeft -= bytesRead;
-      
-      //Increase cursor count 
-      fdtArr[bvfs_FD]->cursor += bytesRead;
-      
-      //Increase the number of bytes read
-      totalBytesRead += bytesRead;
-
+  ioSeg segs[MAX_EXTENTS];
+  int numSegs = getInode(id)->isInline ? 0 : planIO(id, fdt->cursor, count, NULL, segs);
+  int numSpans = 0;
+  if(getInode(id)->isInline){
+    //an inline file's bytes are in its iNode, which a write, truncate or unlink can change
+    //under the view - they go out as one span over a copy the descriptor keeps until release
+    if(count > 0 && maxSpans > 0 && !fdt->viewCopied){
+      if(fdt->viewCopy == NULL){
+        fdt->viewCopy = (char *)malloc(INLINE_DATA);
+      }
+      memcpy(fdt->viewCopy, getInode(id)->data + fdt->cursor, count);
+      fdt->viewCopied = 1;
+      spans[0].data = fdt->viewCopy;
+      spans[0].len = count;
+      numSpans = 1;
     }
-    return totalBytesRead;
+  }else if(diskMap != NULL){
+    //the mapping is the file - one span per run of blocks
+    for(; numSpans < numSegs && numSpans < maxSpans; numSpans++){
+      spans[numSpans].data = diskMap + segs[numSpans].pos;
+      spans[numSpans].len = segs[numSpans].len;
+    }
+  }else{
+    if(fdt->viewPins == NULL){
+      fdt->viewPins = (int *)malloc(MAX_IOV * sizeof(int));
+    }
+    numSpans = cacheView(fdt, segs, numSegs, spans, maxSpans);
   }
-  else{
-    printf("File wasn't opened in read mode\n");
-    return -1;
+  unlockRW(&getSlot(id)->lock);
+
+  for(int i=0; i<numSpans; i++){
+    fdt->cursor += spans[i].len;
   }
+  fdt->raNext = fdt->cursor;
+  return numSpans;
 }
 
 /*
- * int bv_unlink(const char* fileName);
+ * int bv_release_view(int bvfs_FD);
  *
- * This function is intended to delete a file that has been allocated within
- * the bvfs file system.
+ * Gives back every span bv_read_view handed out on the descriptor. They
+ * can't be used after this.
  *
  * Input Parameters
- *   fileName: A c-string representing the name of the file you wish to delete
- *             from the bvfs file system.
+ *   bvfs_FD: The identifier for the file the views came from.
  *
  * Return Value
- *   int:  0 if the delete succeeded.
- *        -1 if some kind of failure occurred (eg. the file does not exist).
- *           Also, print a meaningful error to stderr prior to returning.
+ *   int:  0 if the views were released.
+ *        -1 if the file is not currently opened via bv_open. Also, print a
+ *           meaningful error to stderr prior to returning.
  */
-int bv_unlink(const char* fileName) {
-  iNode *file = NULL;
-  //Loop through iNode Array
-  for(int i=0; i<256; i++){
-    //find if we have a file with that name
-    if(!strcmp(iNodeArray[i]->name, fileName)){
-      file = iNodeArray[i];
-    }
-  }
-
-  //if file never got set so we didn't have that filename - so return -1
-  if(file == NULL){
-    printf("couldn't find that file to delete\n");
+int bv_release_view(int bvfs_FD) {
+  fdTable *fdt = getFD(bvfs_FD);
+  if(fdt == NULL){
+    printf("File is not open\n");
     return -1;
   }
-  //"free" all the blocks it had 
-  removeDiskMap(file);
-  //set the iNode back to unused state
-  file->numBytes = -1;
-
-  num_files--;
+  releaseViews(fdt);
   return 0;
 }
 
 /*
- * void bv_ls();
- *
- * This function will list the contests of the single-directory file system.
- * First, you must print out a header that declares how many files live within
- * the file system. See the example below in which we print "2 Files" up top.
- * Then display the following information for each file listed:
- *   1) the file size in bytes
- *   2) the number of blocks occupied within bvfs
- *   3) the time and date of last modification (derived from unix timestamp)
- *   4) the name of the file.
- * An example of such output appears below:
- *    | 2 Files
- *    | bytes:  276, blocks: 1, Tue Nov 14 09:01:32 2017, bvfs.h
- *    | bytes: 1998, blocks: 4, Tue Nov 14 10:32:02 2017, notes.txt
+ * int bv_export(int bvfs_FD, int host_FD, size_t count);
  *
- * Hint: #include <time.h>
- * Hint: time_t now = time(NULL); // gets the current unix timestamp (32 bits)
- * Hint: printf("%s\n", ctime(&now));
+ * Copies count bytes from the cursor of the file to host_FD (a file or
+ * socket outside bvfs, written at its own offset) without passing them
+ * through user space. Dirty cached blocks of the range are written back
+ * first, then each run of blocks goes across with copy_file_range, or
+ * sendfile when the kernel can't do that between these two files.
  *
  * Input Parameters
- *   None
+ *   bvfs_FD: The identifier for the file to read from.
+ *   host_FD: A host file descriptor open for writing.
+ *   count: The number of bytes to copy.
  *
  * Return Value
- *   void
+ *   int: >=0 the number of bytes copied - the cursor moves past them. Short
+ *           at the end of the file.
+ *        -1 if some kind of failure occurred (eg. the file isn't open for
+ *           reading or host_FD can't be written). Also, print a meaningful error to stderr
+ *           prior to returning.
  */
-void bv_ls() {
-  printf("| %d Files\n", num_files);
-  //Loop through iNodes and print info about them
-  for(int i=0; i<MAX_FILES; i++){
-    iNode *curr = iNodeArray[i];
-    //if the iNode points to a file
-    if(curr->numBytes != -1){
-      int numBlocks = curr->numBytes / BLOCK_SIZE;
-      if (curr->numBytes % BLOCK_SIZE != 0)
-        numBlocks++;
-      printf("| bytes: %d, blocks: %d, %.24s, %s\n", curr->numBytes,  numBlocks, ctime(&(curr->time)), curr->name);
+int bv_export(int bvfs_FD, int host_FD, size_t count) {
+  fdTable *fdt = getFD(bvfs_FD);
+  if(fdt == NULL || !canRead(fdt)){
+    printf("File is not open for reading\n");
+    return -1;
+  }
+  settleStage(bvfs_FD);
+  int id = fdt->inode;
+  readLock(&getSlot(id)->lock);
+  //stops at the end of the file
+  int left = getInode(id)->numBytes - fdt->cursor;
+  if(left < 0 || count > (size_t)left){
+    count = (left > 0) ? left : 0;
+  }
+  ioSeg segs[MAX_EXTENTS];
+  int numSegs = getInode(id)->isInline ? 0 : planIO(id, fdt->cursor, count, NULL, segs);
+  //the kernel copies from the partition file - anything newer is still in the cache
+  cacheSettle(segs, numSegs, 0);
+
+  int total = 0;
+  int failed = 0;
+  //an inline file has no blocks to copy from - its bytes go out of the iNode
+  if(getInode(id)->isInline){
+    while(total < (int)count){
+      ssize_t done = write(host_FD, getInode(id)->data + fdt->cursor + total, count - total);
+      if(done <= 0){
+        failed = 1;
+        break;
+      }
+      total += done;
     }
   }
+  for(int i=0; i<numSegs && !failed; i++){
+    off_t from = segs[i].pos;
+    int left = segs[i].len;
+    while(left > 0){
+#ifdef __linux__
+      ssize_t done = copy_file_range(pFD, &from, host_FD, NULL, left, 0);
+      if(done < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)){
+        done = sendfile(host_FD, pFD, &from, left);
+      }
+#else
+      char block[4096];
+      ssize_t done = pread(pFD, block, (left < (int)sizeof(block)) ? left : (int)sizeof(block), from);
+      if(done > 0){
+        done = write(host_FD, block, done);
+        from += (done > 0) ? done : 0;
+      }
+#endif
+      if(done <= 0){
+        failed = 1;
+        break;
+      }
+      left -= done;
+      total += done;
+    }
+  }
+  unlockRW(&getSlot(id)->lock);
+
+  fdt->cursor += total;
+  fdt->raNext = fdt->cursor;
+  if(failed && total == 0){
+    printf("Couldn't export to host file descriptor %d: %s\n", host_FD, strerror(errno));
+    return -1;
+  }
+  return total;
 }
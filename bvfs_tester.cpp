@@ -5,6 +5,7 @@
 #include <fstream>
 #include <errno.h>
 #include <string.h>
+#include <thread>
 #include "bvfs.h"
 using namespace std;
 
@@ -64,7 +65,7 @@ void READ(int fd, void* buf, int numBytes) {
 }
 
 int OPEN(const char* fileName, int mode) {
-  string strMode[] = {"BV_RDONLY", "BV_WCONCAT", "BV_WTRUNC"};
+  string strMode[] = {"BV_RDONLY", "BV_WCONCAT", "BV_WTRUNC", "BV_RDWR"};
   *out << "  bv_open(\"" << fileName << "\", " << strMode[mode] << ")" << endl;
   int fd = bv_open(fileName, mode);
   if (fd <= -1)
@@ -601,6 +602,1524 @@ vector<void (*)()> testSuite {
     DESTROY(partition2Name);
     unlink(partition2Name);
   },
+
+
+  []() {
+    *out << "[Fill and unlink a file more times than the partition has room for]" << endl;
+    int SZ = 16384;
+    int inData[SZ], outData[SZ];
+    for(int i=0; i < SZ; i++) inData[i] = rand();
+
+    INIT(defaultPartitionName);
+    for(int round=0; round < 200; round++) {
+      int fd = bv_open("full-file.data", BV_WCONCAT);
+      if (fd < 0)
+        die("bv_open failed on round ", to_string(round));
+      if (bv_write(fd, inData, sizeof(inData)) != (int)sizeof(inData))
+        die("bv_write could not fill the file on round ", to_string(round));
+      bv_close(fd);
+      if (bv_unlink("full-file.data") != 0)
+        die("bv_unlink failed on round ", to_string(round));
+    }
+    *out << "  200 rounds of bv_open/bv_write/bv_close/bv_unlink" << endl;
+
+    int fd = OPEN("full-file.data", BV_WCONCAT);
+    WRITE(fd, inData, sizeof(inData));
+    CLOSE(fd);
+    DESTROY(defaultPartitionName);
+
+    RE_INIT(defaultPartitionName);
+    fd = OPEN("full-file.data", BV_RDONLY);
+    READ(fd, outData, sizeof(outData));
+    for(int i=0; i < SZ; i++) {
+      if (inData[i] != outData[i])
+        die("data read differs from data written at byte ", to_string(i*4));
+    }
+    CLOSE(fd);
+
+    DESTROY(defaultPartitionName);
+    unlink(defaultPartitionName);
+  },
+
+
+  []() {
+    *out << "[Write a file past 64KiB and two interleaved files, destroy/init, read back]" << endl;
+    const int SZ = 65536;
+    int bigIn[SZ], bigOut[SZ];
+    char in1[51200], in2[51200], out1[51200], out2[51200];
+    for(int i=0; i < SZ; i++) bigIn[i] = rand();
+    for(int i=0; i < 51200; i++) { in1[i] = (char)rand(); in2[i] = (char)rand(); }
+
+    INIT(defaultPartitionName);
+    int fd = OPEN("big-file.data", BV_WCONCAT);
+    WRITE(fd, bigIn, sizeof(bigIn));
+    CLOSE(fd);
+
+    // Alternating block-sized writes leave each file in many one-block extents
+    int fd1 = OPEN("file1.data", BV_WCONCAT);
+    int fd2 = OPEN("file2.data", BV_WCONCAT);
+    for(int i=0; i < 100; i++) {
+      if (bv_write(fd1, in1 + i*512, 512) != 512 || bv_write(fd2, in2 + i*512, 512) != 512)
+        die("interleaved bv_write failed at block ", to_string(i));
+    }
+    *out << "  100 rounds of bv_write(fd1, buf, 512) and bv_write(fd2, buf, 512)" << endl;
+    CLOSE(fd1);
+    CLOSE(fd2);
+    DESTROY(defaultPartitionName);
+
+    RE_INIT(defaultPartitionName);
+    fd = OPEN("big-file.data", BV_RDONLY);
+    READ(fd, bigOut, sizeof(bigOut));
+    for(int i=0; i < SZ; i++) {
+      if (bigIn[i] != bigOut[i])
+        die("data read differs from data written at byte ", to_string(i*4));
+    }
+    CLOSE(fd);
+
+    fd1 = OPEN("file1.data", BV_RDONLY);
+    READ(fd1, out1, sizeof(out1));
+    CLOSE(fd1);
+    fd2 = OPEN("file2.data", BV_RDONLY);
+    READ(fd2, out2, sizeof(out2));
+    CLOSE(fd2);
+    if (memcmp(in1, out1, sizeof(in1)) != 0 || memcmp(in2, out2, sizeof(in2)) != 0)
+      die("data read from interleaved files differs from data written");
+
+    // The extent block a ninth extent needs goes out of the way - the file's next growth
+    // still lengthens its last run
+    int fd3 = OPEN("file3.data", BV_WCONCAT);
+    int fd4 = OPEN("file4.data", BV_WCONCAT);
+    for(int i=0; i < 8; i++) {
+      if (bv_pwrite(fd3, in1 + i*512, 512, i*512) != 512 || bv_pwrite(fd4, in2 + i*512, 512, i*512) != 512)
+        die("interleaved bv_pwrite failed at block ", to_string(i));
+    }
+    *out << "  8 rounds of bv_pwrite(fd3, buf, 512, at) and bv_pwrite(fd4, buf, 512, at)" << endl;
+    *out << "  bv_pwrite(fd3, buf, 5120, 4096), bv_pwrite(fd3, buf, 5120, 9216)" << endl;
+    if (bv_pwrite(fd3, in1, 5120, 4096) != 5120 || bv_pwrite(fd3, in1, 5120, 9216) != 5120)
+      die("bv_pwrite past the inline extents failed");
+    int extents = getInode(fdtArr[fd3].inode)->numExtents;
+    if (extents != 9)
+      die("the extent block cut the file's last run short - extents: ", to_string(extents));
+    // bv_stat counts the extent block with the 28 blocks of data
+    bvStat st;
+    if (bv_stat("file3.data", &st) != 0 || st.size != 14336 || st.blocks != 29)
+      die("bv_stat didn't count the extent block - blocks: ", to_string(st.blocks));
+    CLOSE(fd3);
+    CLOSE(fd4);
+
+    DESTROY(defaultPartitionName);
+    unlink(defaultPartitionName);
+  },
+
+
+  []() {
+    *out << "[Write with BV_MMAP, read without it, and the reverse]" << endl;
+    const int SZ = 40000;
+    int in1[SZ], in2[SZ], out1[SZ], out2[SZ];
+    for(int i=0; i < SZ; i++) { in1[i] = rand(); in2[i] = rand(); }
+    bvOptions opts = { BV_MMAP };
+
+    unlink(defaultPartitionName);
+    *out << "  bv_init_opts(\"" << defaultPartitionName << "\", BV_MMAP)" << endl;
+    if (bv_init_opts(defaultPartitionName, &opts) != 0)
+      die("bv_init_opts failed to map the partition");
+    int fd = OPEN("mapped.data", BV_WCONCAT);
+    WRITE(fd, in1, sizeof(in1));
+    CLOSE(fd);
+    DESTROY(defaultPartitionName);
+
+    RE_INIT(defaultPartitionName);
+    fd = OPEN("mapped.data", BV_RDONLY);
+    READ(fd, out1, sizeof(out1));
+    CLOSE(fd);
+    fd = OPEN("unmapped.data", BV_WCONCAT);
+    WRITE(fd, in2, sizeof(in2));
+    CLOSE(fd);
+    DESTROY(defaultPartitionName);
+
+    *out << "  bv_init_opts(\"" << defaultPartitionName << "\", BV_MMAP)" << endl;
+    if (bv_init_opts(defaultPartitionName, &opts) != 0)
+      die("bv_init_opts failed to map the partition");
+    fd = OPEN("unmapped.data", BV_RDONLY);
+    READ(fd, out2, sizeof(out2));
+    CLOSE(fd);
+    DESTROY(defaultPartitionName);
+
+    if (memcmp(in1, out1, sizeof(in1)) != 0)
+      die("data written through the mapping differs when read back");
+    if (memcmp(in2, out2, sizeof(in2)) != 0)
+      die("data read through the mapping differs from data written");
+
+    unlink(defaultPartitionName);
+  },
+
+
+  []() {
+    *out << "[Small appends through a small cache, bv_sync, init without destroy, read back]" << endl;
+    char inData[5000], outData[5000];
+    for(int i=0; i < 5000; i++) inData[i] = (char)rand();
+    bvOptions opts = { 0, 8 };
+
+    unlink(defaultPartitionName);
+    *out << "  bv_init_opts(\"" << defaultPartitionName << "\", 8 cache blocks)" << endl;
+    if (bv_init_opts(defaultPartitionName, &opts) != 0)
+      die("bv_init_opts failed");
+    int fd = OPEN("appends.data", BV_WCONCAT);
+    for(int i=0; i < 50; i++)
+      WRITE(fd, inData + i*100, 100);
+    CLOSE(fd);
+
+    for(int pass=0; pass < 2; pass++) {
+      fd = OPEN("appends.data", BV_RDONLY);
+      for(int i=0; i < 50; i++)
+        READ(fd, outData + i*100, 100);
+      CLOSE(fd);
+      if (memcmp(inData, outData, sizeof(inData)) != 0)
+        die("data read through the cache differs from data written");
+    }
+
+    bvCacheStats stats;
+    bv_cache_stats(&stats);
+    *out << "  bv_cache_stats() -> hits: " << stats.hits << ", misses: " << stats.misses << endl;
+    if (stats.hits == 0 || stats.misses == 0)
+      die("cache counters are not being kept");
+
+    *out << "  bv_sync()" << endl;
+    if (bv_sync() != 0)
+      die("bv_sync failed");
+
+    // Mount again without bv_destroy - only what bv_sync wrote is there
+    RE_INIT(defaultPartitionName);
+    bzero(outData, sizeof(outData));
+    fd = OPEN("appends.data", BV_RDONLY);
+    READ(fd, outData, sizeof(outData));
+    CLOSE(fd);
+    if (memcmp(inData, outData, sizeof(inData)) != 0)
+      die("data read after bv_sync and a fresh init differs from data written");
+
+    DESTROY(defaultPartitionName);
+    unlink(defaultPartitionName);
+  },
+
+
+  []() {
+    *out << "[Create 600 files past the first 256 iNodes, unlink/recreate, destroy/init, read all back, fill a small partition's iNode map]" << endl;
+    char name[32];
+
+    INIT(defaultPartitionName);
+    for(int i=0; i < 600; i++) {
+      sprintf(name, "file%d.data", i);
+      int fd = bv_open(name, BV_WCONCAT);
+      if (fd < 0 || bv_write(fd, &i, sizeof(i)) != sizeof(i) || bv_close(fd) != 0)
+        die("could not create and write file ", name);
+    }
+    *out << "  600 rounds of bv_open/bv_write/bv_close" << endl;
+
+    *out << "  bv_unlink(\"file7.data\")" << endl;
+    if (bv_unlink("file7.data") != 0)
+      die("bv_unlink failed to remove file7.data");
+    int fd = OPEN("file7.data", BV_WCONCAT);
+    int seven = 7777;
+    WRITE(fd, &seven, sizeof(seven));
+    CLOSE(fd);
+    DESTROY(defaultPartitionName);
+
+    // The grown table comes back from the iNode map, read in and mapped
+    bvOptions mapped = { BV_MMAP, 0, NULL, 0, 0, 0, 0 };
+    for(int mode=0; mode < 2; mode++) {
+      *out << "  bv_init_opts(\"" << defaultPartitionName << "\", " << (mode == 0 ? "NULL" : "BV_MMAP") << ")" << endl;
+      if (bv_init_opts(defaultPartitionName, mode == 0 ? NULL : &mapped) != 0)
+        die("bv_init_opts failed to mount a partition with a grown iNode table");
+      for(int i=0; i < 600; i++) {
+        int num = -1;
+        sprintf(name, "file%d.data", i);
+        fd = bv_open(name, BV_RDONLY);
+        if (fd < 0 || bv_read(fd, &num, sizeof(num)) != sizeof(num) || bv_close(fd) != 0)
+          die("could not read back file ", name);
+        if (num != (i == 7 ? 7777 : i))
+          die("wrong contents in file ", name);
+      }
+      *out << "  600 rounds of bv_open/bv_read/bv_close" << endl;
+
+      redirectOutput();
+      bv_ls();
+      string output = restoreOutput();
+      if (output.find("600 File") == string::npos)
+        die("bv_ls is not counting the files that were on disk. Received:\n", output);
+      DESTROY(defaultPartitionName);
+    }
+    unlink(defaultPartitionName);
+
+    // 1024 blocks have room in the map for 16 chunks of 64 - 1280 iNodes, one is the root
+    bvOptions small = { 0, 0, NULL, 0, 0, 512, 1024 };
+    *out << "  bv_init_opts(\"" << defaultPartitionName << "\", blockCount 1024)" << endl;
+    if (bv_init_opts(defaultPartitionName, &small) != 0)
+      die("bv_init_opts failed");
+    for(int i=0; i < 1279; i++) {
+      sprintf(name, "f%d", i);
+      fd = bv_open(name, BV_WCONCAT);
+      if (fd < 0 || bv_close(fd) != 0)
+        die("could not create file ", name);
+    }
+    *out << "  1279 rounds of bv_open/bv_close" << endl;
+    *out << "  bv_open(\"one-too-many\", BV_WCONCAT)" << endl;
+    redirectOutput();
+    fd = bv_open("one-too-many", BV_WCONCAT);
+    string output = restoreOutput();
+    if (fd != -1)
+      die("bv_open created a file past the biggest iNode table, returned ", to_string(fd));
+    if (output.size() == 0)
+      die("bv_open didn't say why it couldn't create the file");
+    DESTROY(defaultPartitionName);
+    unlink(defaultPartitionName);
+
+    // The default size's map takes two blocks - the table grows past the 8448 iNodes one holds
+    INIT(defaultPartitionName);
+    for(int i=0; i < 8448; i++) {
+      sprintf(name, "f%d", i);
+      fd = bv_open(name, BV_WCONCAT);
+      if (fd < 0 || bv_close(fd) != 0)
+        die("could not create file ", name);
+    }
+    *out << "  8448 rounds of bv_open/bv_close" << endl;
+    DESTROY(defaultPartitionName);
+    RE_INIT(defaultPartitionName);
+    bvStat st;
+    *out << "  bv_stat(\"f8447\", &st)" << endl;
+    if (bv_stat("f8447", &st) != 0)
+      die("the file in the iNode past the first map block didn't come back");
+    DESTROY(defaultPartitionName);
+    unlink(defaultPartitionName);
+  },
+
+
+  []() {
+    *out << "[Open one file with many readers, reject a second writer or a truncate, unlink while open]" << endl;
+    int nums[3] = {111, 222, 333};
+    int got[3] = {0, 0, 0};
+
+    INIT(defaultPartitionName);
+    int wfd = OPEN("shared.data", BV_WCONCAT);
+    WRITE(wfd, nums, sizeof(nums));
+
+    *out << "  bv_open(\"shared.data\", BV_WTRUNC)" << endl;
+    redirectOutput();
+    int fd = bv_open("shared.data", BV_WTRUNC);
+    string output = restoreOutput();
+    if (fd != -1)
+      die("bv_open gave a second writer a file descriptor: ", to_string(fd));
+    CLOSE(wfd);
+
+    // Each reader keeps its own cursor
+    int r1 = OPEN("shared.data", BV_RDONLY);
+    int r2 = OPEN("shared.data", BV_RDONLY);
+    int r3 = OPEN("shared.data", BV_RDONLY);
+    if (r1 == r2 || r2 == r3 || r1 == r3)
+      die("readers of the same file were given the same file descriptor");
+    READ(r1, &got[0], sizeof(int));
+    READ(r2, &got[0], sizeof(int));
+    READ(r2, &got[1], sizeof(int));
+    READ(r3, got, sizeof(got));
+    if (got[0] != 111 || got[1] != 222 || got[2] != 333)
+      die("readers don't have independent cursors");
+
+    // Truncating would pull the blocks out from under the readers
+    *out << "  bv_open(\"shared.data\", BV_WTRUNC)" << endl;
+    redirectOutput();
+    fd = bv_open("shared.data", BV_WTRUNC);
+    restoreOutput();
+    if (fd != -1)
+      die("bv_open truncated a file readers have open: ", to_string(fd));
+
+    // Unlinking frees the name right away and the data on the last close
+    *out << "  bv_unlink(\"shared.data\")" << endl;
+    if (bv_unlink("shared.data") != 0)
+      die("bv_unlink failed on an open file");
+    READ(r1, &got[1], sizeof(int));
+    if (got[1] != 222)
+      die("open reader lost its data after bv_unlink");
+    CLOSE(r1);
+    CLOSE(r2);
+    CLOSE(r3);
+
+    redirectOutput();
+    fd = bv_open("shared.data", BV_RDONLY);
+    int closeRet = bv_close(776);
+    output = restoreOutput();
+    if (fd != -1)
+      die("bv_open found a file that was unlinked");
+    if (closeRet != -1)
+      die("bv_close accepted a file descriptor that was never handed out");
+
+    DESTROY(defaultPartitionName);
+    unlink(defaultPartitionName);
+  },
+
+
+  []() {
+    *out << "[BV_THREADSAFE: 4 writer threads and 4 reader threads at once]" << endl;
+    static int shared[4096];
+    for(int i=0; i < 4096; i++) shared[i] = rand();
+    bvOptions opts = { BV_THREADSAFE, 16 };
+
+    unlink(defaultPartitionName);
+    *out << "  bv_init_opts(\"" << defaultPartitionName << "\", BV_THREADSAFE)" << endl;
+    if (bv_init_opts(defaultPartitionName, &opts) != 0)
+      die("bv_init_opts failed");
+    int fd = OPEN("shared.data", BV_WCONCAT);
+    WRITE(fd, shared, sizeof(shared));
+    CLOSE(fd);
+
+    // Writers append small records to their own files, readers re-read one shared file
+    int failures[8] = {0};
+    vector<thread> threads;
+    for(int t=0; t < 4; t++) {
+      threads.push_back(thread([t, &failures]() {
+        char name[32];
+        sprintf(name, "writer%d.data", t);
+        int wfd = bv_open(name, BV_WCONCAT);
+        for(int i=0; i < 2000; i++) {
+          int rec = t * 100000 + i;
+          if (bv_write(wfd, &rec, sizeof(rec)) != sizeof(rec)) failures[t]++;
+        }
+        if (bv_close(wfd) != 0) failures[t]++;
+      }));
+      threads.push_back(thread([t, &failures]() {
+        static thread_local int buf[4096];
+        for(int round=0; round < 20; round++) {
+          int rfd = bv_open("shared.data", BV_RDONLY);
+          for(int i=0; i < 4096; i += 128)
+            if (bv_read(rfd, buf + i, 512) != 512) failures[4+t]++;
+          if (bv_close(rfd) != 0 || memcmp(buf, shared, sizeof(shared)) != 0) failures[4+t]++;
+        }
+      }));
+    }
+    for(auto &th : threads) th.join();
+    *out << "  4 threads x 2000 bv_write, 4 threads x 20 full reads" << endl;
+    for(int t=0; t < 8; t++)
+      if (failures[t])
+        die("a thread saw failed or wrong I/O: thread ", to_string(t));
+    DESTROY(defaultPartitionName);
+
+    RE_INIT(defaultPartitionName);
+    for(int t=0; t < 4; t++) {
+      char name[32];
+      sprintf(name, "writer%d.data", t);
+      static int recs[2000];
+      fd = OPEN(name, BV_RDONLY);
+      READ(fd, recs, sizeof(recs));
+      CLOSE(fd);
+      for(int i=0; i < 2000; i++)
+        if (recs[i] != t * 100000 + i)
+          die("records from a writer thread came back wrong in ", name);
+    }
+    DESTROY(defaultPartitionName);
+    unlink(defaultPartitionName);
+  },
+
+
+  []() {
+    *out << "[Closed and unlinked files survive init without destroy through the journal]" << endl;
+    static char dataA[20480], dataB[20480], outData[20480], junk[100000];
+    for(int i=0; i < 20480; i++) {
+      dataA[i] = (char)rand();
+      dataB[i] = (char)rand();
+    }
+
+    INIT(defaultPartitionName);
+    // Interleaved writes give both files more extents than fit in the iNode
+    int fdA = OPEN("journal-a.data", BV_WCONCAT);
+    int fdB = OPEN("journal-b.data", BV_WCONCAT);
+    for(int i=0; i < 40; i++) {
+      if (bv_write(fdA, dataA + i*512, 512) != 512 || bv_write(fdB, dataB + i*512, 512) != 512)
+        die("interleaved bv_write failed on round ", to_string(i));
+    }
+    *out << "  40 rounds of bv_write(fdA, buf, 512) and bv_write(fdB, buf, 512)" << endl;
+    CLOSE(fdA);
+    CLOSE(fdB);
+    int fd = OPEN("journal-gone.data", BV_WCONCAT);
+    WRITE(fd, junk, sizeof(junk));
+    CLOSE(fd);
+    *out << "  bv_unlink(\"journal-gone.data\")" << endl;
+    if (bv_unlink("journal-gone.data") != 0)
+      die("bv_unlink failed");
+
+    // Mount again without bv_destroy - the journal has to bring everything back
+    for(int pass=0; pass < 2; pass++) {
+      RE_INIT(defaultPartitionName);
+      *out << "  bv_open(\"journal-gone.data\", BV_RDONLY)" << endl;
+      redirectOutput();
+      fd = bv_open("journal-gone.data", BV_RDONLY);
+      restoreOutput();
+      if (fd != -1)
+        die("an unlinked file came back after init");
+
+      // Blocks the unlinked file gave back must really be free
+      if (pass == 0) {
+        fd = OPEN("journal-new.data", BV_WCONCAT);
+        WRITE(fd, junk, sizeof(junk));
+        CLOSE(fd);
+      }
+
+      const char *names[2] = { "journal-a.data", "journal-b.data" };
+      char *expect[2] = { dataA, dataB };
+      for(int f=0; f < 2; f++) {
+        fd = OPEN(names[f], BV_RDONLY);
+        READ(fd, outData, sizeof(outData));
+        CLOSE(fd);
+        if (memcmp(outData, expect[f], sizeof(outData)) != 0)
+          die("data read after init without destroy differs in ", names[f]);
+      }
+      if (pass == 1)
+        DESTROY(defaultPartitionName);
+    }
+    unlink(defaultPartitionName);
+  },
+
+
+  []() {
+    *out << "[bv_fsync an open file, init without destroy, destroy, init, read back]" << endl;
+    char inData[3000], outData[3000];
+    for(int i=0; i < 3000; i++) inData[i] = (char)rand();
+
+    INIT(defaultPartitionName);
+    int other = OPEN("untouched.data", BV_WCONCAT);
+    WRITE(other, inData, 100);
+    CLOSE(other);
+    int fd = OPEN("fsynced.data", BV_WCONCAT);
+    WRITE(fd, inData, sizeof(inData));
+    *out << "  bv_fsync(fd)" << endl;
+    if (bv_fsync(fd) != 0)
+      die("bv_fsync failed on an open file");
+    *out << "  bv_fsync(777)" << endl;
+    redirectOutput();
+    int ret = bv_fsync(777);
+    restoreOutput();
+    if (ret != -1)
+      die("bv_fsync accepted a file descriptor that was never handed out");
+
+    // The file is still open - only the fsync makes it survive. The replayed
+    // metadata then has to reach its home blocks at the next checkpoint.
+    RE_INIT(defaultPartitionName);
+    DESTROY(defaultPartitionName);
+    RE_INIT(defaultPartitionName);
+    fd = OPEN("fsynced.data", BV_RDONLY);
+    READ(fd, outData, sizeof(outData));
+    CLOSE(fd);
+    if (memcmp(inData, outData, sizeof(outData)) != 0)
+      die("data read after bv_fsync and init without destroy differs from data written");
+    fd = OPEN("untouched.data", BV_RDONLY);
+    READ(fd, outData, 100);
+    CLOSE(fd);
+    if (memcmp(inData, outData, 100) != 0)
+      die("a file not changed since the last checkpoint came back wrong");
+
+    DESTROY(defaultPartitionName);
+    unlink(defaultPartitionName);
+  },
+
+
+  []() {
+    *out << "[Async writes and reads across files in one submit, with and without BV_URING]" << endl;
+    static char ioBuffer[8 * 4096], plain[4 * 4096], cached[1000], outData[4096];
+    for(int i=0; i < (int)sizeof(ioBuffer); i++) ioBuffer[i] = (char)rand();
+    for(int i=0; i < (int)sizeof(plain); i++) plain[i] = (char)rand();
+    for(int i=0; i < (int)sizeof(cached); i++) cached[i] = (char)rand();
+
+    for(int mode=0; mode < 2; mode++) {
+      bvOptions opts = { mode == 0 ? BV_URING : 0, 0, ioBuffer, sizeof(ioBuffer) };
+      unlink(defaultPartitionName);
+      *out << "  bv_init_opts(\"" << defaultPartitionName << "\", " << (mode == 0 ? "BV_URING" : "no flags") << ")" << endl;
+      if (bv_init_opts(defaultPartitionName, &opts) != 0)
+        die("bv_init_opts failed");
+
+      // A file whose data only sits dirty in the cache so far
+      int fd = OPEN("cached.data", BV_WCONCAT);
+      WRITE(fd, cached, sizeof(cached));
+      CLOSE(fd);
+
+      // Two writes to each of 4 files - registered buffer for the first, plain memory for the second
+      char name[32];
+      int fds[4];
+      for(int f=0; f < 4; f++) {
+        sprintf(name, "async%d.data", f);
+        fds[f] = OPEN(name, BV_WCONCAT);
+        if (bv_write_async(fds[f], ioBuffer + f*4096, 4096, (void*)(long)(f*2)) != 0 ||
+            bv_write_async(fds[f], plain + f*4096, 4096, (void*)(long)(f*2+1)) != 0)
+          die("bv_write_async failed on ", name);
+      }
+      *out << "  8 x bv_write_async(fd, buf, 4096), bv_submit()" << endl;
+      bv_submit();
+      bvCompletion done[8];
+      int got = 0;
+      int seen = 0;
+      while(got < 8) {
+        int n = bv_reap(done, 8, 8 - got);
+        for(int i=0; i < n; i++) {
+          if (done[i].result != 4096)
+            die("an async write came back with ", to_string(done[i].result));
+          seen |= 1 << (long)done[i].tag;
+        }
+        got += n;
+      }
+      if (seen != 0xFF)
+        die("bv_reap lost or repeated a completion tag");
+      for(int f=0; f < 4; f++)
+        CLOSE(fds[f]);
+
+      // Read the first half of every file, and the cached file, back asynchronously
+      static char back[5][4096];
+      for(int f=0; f < 4; f++) {
+        sprintf(name, "async%d.data", f);
+        fds[f] = OPEN(name, BV_RDONLY);
+        if (bv_read_async(fds[f], back[f], 4096, (void*)(long)f) != 0)
+          die("bv_read_async failed on ", name);
+      }
+      fd = OPEN("cached.data", BV_RDONLY);
+      if (bv_read_async(fd, back[4], sizeof(cached), (void*)4L) != 0)
+        die("bv_read_async failed on cached.data");
+      *out << "  5 x bv_read_async(fd, buf, n), bv_reap(done, 8, 5)" << endl;
+      got = 0;
+      while(got < 5)
+        got += bv_reap(done + got, 8 - got, 5 - got);
+      for(int f=0; f < 4; f++) {
+        if (memcmp(back[f], ioBuffer + f*4096, 4096) != 0)
+          die("data read asynchronously differs from data written in file ", to_string(f));
+        CLOSE(fds[f]);
+      }
+      if (memcmp(back[4], cached, sizeof(cached)) != 0)
+        die("an async read missed data still in the buffer cache");
+      CLOSE(fd);
+      DESTROY(defaultPartitionName);
+
+      // The second half comes back through the plain synchronous path
+      RE_INIT(defaultPartitionName);
+      for(int f=0; f < 4; f++) {
+        sprintf(name, "async%d.data", f);
+        fd = OPEN(name, BV_RDONLY);
+        READ(fd, outData, 4096);
+        READ(fd, outData, 4096);
+        CLOSE(fd);
+        if (memcmp(outData, plain + f*4096, 4096) != 0)
+          die("data written asynchronously differs after destroy/init in ", name);
+      }
+      DESTROY(defaultPartitionName);
+    }
+    unlink(defaultPartitionName);
+  },
+
+
+  []() {
+    *out << "[Read a 64KiB file front to back in 100 byte chunks - readahead keeps it in the cache]" << endl;
+    static char inData[65536], outData[65536];
+    for(int i=0; i < 65536; i++) inData[i] = (char)rand();
+
+    INIT(defaultPartitionName);
+    int fd = OPEN("stream.data", BV_WCONCAT);
+    WRITE(fd, inData, sizeof(inData));
+    CLOSE(fd);
+    DESTROY(defaultPartitionName);
+
+    RE_INIT(defaultPartitionName);
+    fd = OPEN("stream.data", BV_RDONLY);
+    for(int at=0; at < 65536; at += 100) {
+      int chunk = (65536 - at < 100) ? 65536 - at : 100;
+      if (bv_read(fd, outData + at, chunk) != chunk)
+        die("bv_read came up short at byte ", to_string(at));
+    }
+    *out << "  656 x bv_read(fd, buf, 100)" << endl;
+    CLOSE(fd);
+    if (memcmp(inData, outData, sizeof(inData)) != 0)
+      die("data read in small chunks differs from data written");
+
+    bvCacheStats stats;
+    bv_cache_stats(&stats);
+    *out << "  bv_cache_stats() -> hits: " << stats.hits << ", misses: " << stats.misses
+         << ", readahead: " << stats.readahead << endl;
+    if (stats.readahead < 128)
+      die("not every block was read ahead: ", to_string(stats.readahead));
+    if (stats.misses != 0)
+      die("sequential reads still missed the cache: ", to_string(stats.misses));
+
+    DESTROY(defaultPartitionName);
+    unlink(defaultPartitionName);
+  },
+
+
+  []() {
+    *out << "[2000 small appends are staged - other readers see them after bv_fsync, bv_close or the flusher]" << endl;
+    static char inData[74000], outData[74000];
+    for(int i=0; i < (int)sizeof(inData); i++) inData[i] = (char)rand();
+
+    INIT(defaultPartitionName);
+    int fd = OPEN("small.data", BV_WCONCAT);
+    for(int i=0; i < 100; i++) {
+      if (bv_write(fd, inData + i*37, 37) != 37)
+        die("a staged write came up short at ", to_string(i));
+    }
+    *out << "  100 x bv_write(fd, buf, 37), bv_fsync(fd)" << endl;
+    if (bv_fsync(fd) != 0)
+      die("bv_fsync failed");
+    int rd = OPEN("small.data", BV_RDONLY);
+    READ(rd, outData, 3700);
+    CLOSE(rd);
+    if (memcmp(inData, outData, 3700) != 0)
+      die("data written out by bv_fsync differs from data written");
+
+    for(int i=100; i < 2000; i++) {
+      if (bv_write(fd, inData + i*37, 37) != 37)
+        die("a staged write came up short at ", to_string(i));
+    }
+    *out << "  1900 x bv_write(fd, buf, 37)" << endl;
+    CLOSE(fd);
+    DESTROY(defaultPartitionName);
+
+    RE_INIT(defaultPartitionName);
+    fd = OPEN("small.data", BV_RDONLY);
+    READ(fd, outData, sizeof(outData));
+    CLOSE(fd);
+    if (memcmp(inData, outData, sizeof(inData)) != 0)
+      die("data written in small appends differs after destroy/init");
+    DESTROY(defaultPartitionName);
+
+    // With a flusher nobody has to ask
+    bvOptions opts = { BV_THREADSAFE, 0, NULL, 0, 5 };
+    *out << "  bv_init_opts(\"" << defaultPartitionName << "\", BV_THREADSAFE, flushMs 5)" << endl;
+    if (bv_init_opts(defaultPartitionName, &opts) != 0)
+      die("bv_init_opts failed");
+    fd = OPEN("flushed.data", BV_WCONCAT);
+    WRITE(fd, inData, 100);
+    usleep(200000);
+    rd = OPEN("flushed.data", BV_RDONLY);
+    READ(rd, outData, 100);
+    CLOSE(rd);
+    if (memcmp(inData, outData, 100) != 0)
+      die("the flusher didn't write out staged data");
+    CLOSE(fd);
+    DESTROY(defaultPartitionName);
+    unlink(defaultPartitionName);
+  },
+
+
+  []() {
+    *out << "[Two writers interleave 100 byte appends - reserved blocks all come back on close, or at the next mount]" << endl;
+    static char aData[40000], bData[40000], outData[40000];
+    for(int i=0; i < 40000; i++) { aData[i] = (char)rand(); bData[i] = (char)rand(); }
+
+    INIT(defaultPartitionName);
+    int a = OPEN("a.data", BV_WCONCAT);
+    int b = OPEN("b.data", BV_WCONCAT);
+    for(int at=0; at < 40000; at += 100) {
+      if (bv_write(a, aData + at, 100) != 100 || bv_write(b, bData + at, 100) != 100)
+        die("an interleaved write came up short at ", to_string(at));
+    }
+    *out << "  400 x (bv_write(a, buf, 100), bv_write(b, buf, 100))" << endl;
+    CLOSE(a);
+    CLOSE(b);
+
+    // Everything but the 2 x 79 blocks of data and the root directory's node is free again
+    static char fill[(16384 - 199 - 158 - 1) * 512];
+    int fd = OPEN("fill.data", BV_WCONCAT);
+    *out << "  bv_write(fd, buf, " << sizeof(fill) << ")" << endl;
+    if (bv_write(fd, fill, sizeof(fill)) != (int)sizeof(fill))
+      die("reserved blocks weren't given back");
+    CLOSE(fd);
+    DESTROY(defaultPartitionName);
+
+    RE_INIT(defaultPartitionName);
+    a = OPEN("a.data", BV_RDONLY);
+    READ(a, outData, 40000);
+    CLOSE(a);
+    if (memcmp(aData, outData, 40000) != 0)
+      die("data from the first writer differs after destroy/init");
+    b = OPEN("b.data", BV_RDONLY);
+    READ(b, outData, 40000);
+    CLOSE(b);
+    if (memcmp(bData, outData, 40000) != 0)
+      die("data from the second writer differs after destroy/init");
+
+    // Only staged appends reserve - a big write takes just its own blocks
+    *out << "  bv_unlink(\"fill.data\")" << endl;
+    if (bv_unlink("fill.data") != 0)
+      die("bv_unlink failed");
+    int c = OPEN("c.data", BV_WCONCAT);
+    WRITE(c, aData, 40000);
+    a = OPEN("a.data", BV_WCONCAT);
+    for(int at=0; at < 1000; at += 100)
+      WRITE(a, aData + at, 100);
+    *out << "  bv_fsync(a), bv_fsync(c)" << endl;
+    bv_fsync(a);
+    bv_fsync(c);
+    redirectOutput();
+    bv_ls();
+    string output = restoreOutput();
+    if (output.find("bytes: 40000, blocks: 79,") == string::npos)
+      die("a single big write kept blocks past its end: ", output);
+
+    // Mount again without closing - what the appender had reserved comes back
+    RE_INIT(defaultPartitionName);
+    redirectOutput();
+    bv_ls();
+    output = restoreOutput();
+    if (output.find("bytes: 41000, blocks: 81,") == string::npos)
+      die("blocks reserved before the crash weren't given back at mount: ", output);
+    static char rest[(16384 - 199 - 81 - 79 - 79 - 1) * 512];
+    fd = OPEN("rest.data", BV_WCONCAT);
+    *out << "  bv_write(fd, buf, " << sizeof(rest) << ")" << endl;
+    if (bv_write(fd, rest, sizeof(rest)) != (int)sizeof(rest))
+      die("reserved blocks weren't given back at mount");
+    CLOSE(fd);
+    DESTROY(defaultPartitionName);
+    unlink(defaultPartitionName);
+  },
+
+
+  []() {
+    *out << "[Read a file through views and export it to a host file, cached and with BV_MMAP]" << endl;
+    static char inData[20000], outData[20000];
+    for(int i=0; i < 20000; i++) inData[i] = (char)rand();
+
+    for(int mode=0; mode < 2; mode++) {
+      bvOptions opts = { mode == 0 ? 0 : BV_MMAP, 0, NULL, 0, 0 };
+      unlink(defaultPartitionName);
+      *out << "  bv_init_opts(\"" << defaultPartitionName << "\", " << (mode == 0 ? "no flags" : "BV_MMAP") << ")" << endl;
+      if (bv_init_opts(defaultPartitionName, &opts) != 0)
+        die("bv_init_opts failed");
+      int fd = OPEN("view.data", BV_WCONCAT);
+      WRITE(fd, inData, sizeof(inData));
+      CLOSE(fd);
+
+      // Views can come back short - take what fits, release, go on
+      fd = OPEN("view.data", BV_RDONLY);
+      bvSpan spans[8];
+      int got = 0;
+      int views = 0;
+      while(got < 20000) {
+        int n = bv_read_view(fd, 20000 - got, spans, 8);
+        if (n <= 0)
+          die("bv_read_view came back with ", to_string(n));
+        for(int i=0; i < n; i++) {
+          memcpy(outData + got, spans[i].data, spans[i].len);
+          got += spans[i].len;
+        }
+        if (bv_release_view(fd) != 0)
+          die("bv_release_view failed");
+        views++;
+      }
+      *out << "  " << views << " x bv_read_view(fd, rest, spans, 8), bv_release_view(fd)" << endl;
+      CLOSE(fd);
+      if (memcmp(inData, outData, sizeof(inData)) != 0)
+        die("data seen through views differs from data written");
+
+      int host = open("export.out", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      fd = OPEN("view.data", BV_RDONLY);
+      *out << "  bv_export(fd, host, 20000)" << endl;
+      if (bv_export(fd, host, 20000) != 20000)
+        die("bv_export came up short");
+      CLOSE(fd);
+      close(host);
+      host = open("export.out", O_RDONLY);
+      memset(outData, 0, sizeof(outData));
+      if (read(host, outData, sizeof(outData)) != (int)sizeof(outData) || memcmp(inData, outData, sizeof(inData)) != 0)
+        die("exported data differs from data written");
+      close(host);
+      unlink("export.out");
+      DESTROY(defaultPartitionName);
+    }
+    unlink(defaultPartitionName);
+  },
+
+
+  []() {
+    *out << "[BV_RDWR - seek, overwrite in place, pread/pwrite, short reads at the end, nothing past INT_MAX]" << endl;
+    static char inData[10000], outData[10000];
+    char patch[100], tail[300];
+    for(int i=0; i < 10000; i++) inData[i] = (char)rand();
+    for(int i=0; i < 100; i++) patch[i] = (char)rand();
+    for(int i=0; i < 300; i++) tail[i] = (char)rand();
+
+    INIT(defaultPartitionName);
+    int fd = OPEN("records.data", BV_RDWR);
+    WRITE(fd, inData, sizeof(inData));
+
+    // Overwrite 100 bytes in the middle - the file keeps its size
+    *out << "  bv_lseek(fd, 5000, BV_SEEK_SET)" << endl;
+    if (bv_lseek(fd, 5000, BV_SEEK_SET) != 5000)
+      die("bv_lseek didn't land on 5000");
+    WRITE(fd, patch, sizeof(patch));
+    memcpy(inData + 5000, patch, sizeof(patch));
+    *out << "  bv_pwrite(fd, buf, 50, 9950)" << endl;
+    if (bv_pwrite(fd, tail, 50, 9950) != 50)
+      die("bv_pwrite came up short");
+    memcpy(inData + 9950, tail, 50);
+    if (bv_lseek(fd, 0, BV_SEEK_END) != 10000)
+      die("overwrites changed the file size");
+
+    // The same descriptor reads it back
+    if (bv_lseek(fd, 0, BV_SEEK_SET) != 0)
+      die("bv_lseek didn't go back to 0");
+    READ(fd, outData, sizeof(outData));
+    if (memcmp(inData, outData, sizeof(inData)) != 0)
+      die("data read back differs after overwrites");
+    CLOSE(fd);
+    DESTROY(defaultPartitionName);
+
+    RE_INIT(defaultPartitionName);
+    fd = OPEN("records.data", BV_RDONLY);
+    *out << "  bv_pread(fd, buf, 100, 5000)" << endl;
+    if (bv_pread(fd, outData, 100, 5000) != 100 || memcmp(outData, patch, 100) != 0)
+      die("bv_pread didn't find the overwrite after destroy/init");
+    *out << "  bv_lseek(fd, 9900, BV_SEEK_SET), bv_read(fd, buf, 300)" << endl;
+    bv_lseek(fd, 9900, BV_SEEK_SET);
+    if (bv_read(fd, outData, 300) != 100 || memcmp(outData, inData + 9900, 100) != 0)
+      die("bv_read at the end of the file didn't come back short");
+    CLOSE(fd);
+
+    // Writing past the end leaves zeros behind
+    fd = OPEN("records.data", BV_RDWR);
+    *out << "  bv_pwrite(fd, buf, 300, 12000)" << endl;
+    if (bv_pwrite(fd, tail, 300, 12000) != 300)
+      die("bv_pwrite past the end came up short");
+    if (bv_pread(fd, outData, 2300, 10000) != 2300)
+      die("bv_pread over the gap came up short");
+    for(int i=0; i < 2000; i++) {
+      if (outData[i] != 0)
+        die("the gap isn't zeros at ", to_string(10000 + i));
+    }
+    if (memcmp(outData + 2000, tail, 300) != 0)
+      die("data written past the end differs");
+
+    // A file tops out at INT_MAX bytes - seeks and writes that would go past are refused
+    *out << "  bv_lseek(fd, INT_MAX, BV_SEEK_SET)" << endl;
+    if (bv_lseek(fd, INT_MAX, BV_SEEK_SET) != INT_MAX)
+      die("bv_lseek to INT_MAX failed");
+    *out << "  bv_lseek(fd, 1, BV_SEEK_CUR), bv_write(fd, buf, 1), bv_pwrite(fd, buf, 10, INT_MAX - 5), bv_pwrite(fd, buf, 4 GiB + 10, 0)" << endl;
+    redirectOutput();
+    int past = bv_lseek(fd, 1, BV_SEEK_CUR);
+    int wrote = bv_write(fd, tail, 1);
+    int over = bv_pwrite(fd, tail, 10, INT_MAX - 5);
+    int wrapped = bv_pwrite(fd, tail, ((size_t)1 << 32) + 10, 0);
+    restoreOutput();
+    if (past != -1 || wrote != -1 || over != -1 || wrapped != -1)
+      die("a seek or write past INT_MAX bytes wasn't refused");
+    if (bv_lseek(fd, 0, BV_SEEK_END) != 12300)
+      die("a refused write changed the file size");
+    CLOSE(fd);
+    DESTROY(defaultPartitionName);
+    unlink(defaultPartitionName);
+  },
+
+
+  []() {
+    *out << "[Format with 4 KiB blocks - mounting reads the geometry back from the superblock]" << endl;
+    static char inData[100000], outData[100000];
+    for(int i=0; i < 100000; i++) inData[i] = (char)rand();
+
+    unlink(defaultPartitionName);
+    bvOptions bad = { 0, 0, NULL, 0, 0, 1000, 0 };
+    *out << "  bv_init_opts(\"" << defaultPartitionName << "\", blockSize 1000)" << endl;
+    redirectOutput();
+    int ret = bv_init_opts(defaultPartitionName, &bad);
+    string output = restoreOutput();
+    if (ret != -1 || output.size() == 0)
+      die("a 1000 byte block size was accepted");
+    if (!fileUnreadable(defaultPartitionName))
+      die("a failed format left the partition file behind");
+
+    bvOptions opts = { 0, 0, NULL, 0, 0, 4096, 4096 };
+    *out << "  bv_init_opts(\"" << defaultPartitionName << "\", blockSize 4096, blockCount 4096)" << endl;
+    if (bv_init_opts(defaultPartitionName, &opts) != 0)
+      die("bv_init_opts failed");
+    int fd = OPEN("big.data", BV_WCONCAT);
+    WRITE(fd, inData, sizeof(inData));
+    CLOSE(fd);
+    *out << "  bv_ls()" << endl;
+    redirectOutput();
+    bv_ls();
+    output = restoreOutput();
+    if (output.find("blocks: 25,") == string::npos)
+      die("100000 bytes should take 25 blocks of 4096: ", output);
+    DESTROY(defaultPartitionName);
+
+    struct stat st;
+    if (stat(defaultPartitionName, &st) != 0 || st.st_size != 4096L * 4096)
+      die("partition file isn't 4096 blocks of 4096 bytes");
+
+    // No options - the superblock says what the partition looks like
+    bvOptions mapped = { BV_MMAP, 0, NULL, 0, 0, 0, 0 };
+    for(int mode=0; mode < 2; mode++) {
+      *out << "  bv_init_opts(\"" << defaultPartitionName << "\", " << (mode == 0 ? "NULL" : "BV_MMAP") << ")" << endl;
+      if (bv_init_opts(defaultPartitionName, mode == 0 ? NULL : &mapped) != 0)
+        die("bv_init_opts failed on a 4 KiB partition");
+      fd = OPEN("big.data", BV_RDONLY);
+      READ(fd, outData, sizeof(outData));
+      CLOSE(fd);
+      if (memcmp(inData, outData, sizeof(inData)) != 0)
+        die("data differs after mounting a 4 KiB partition again");
+      DESTROY(defaultPartitionName);
+    }
+    unlink(defaultPartitionName);
+  },
+
+
+  []() {
+    *out << "[A 16 GiB partition - past what 16 bit blocks and 32 bit offsets can reach]" << endl;
+    static char inData[300000], outData[300000];
+    for(int i=0; i < 300000; i++) inData[i] = (char)rand();
+
+    // 4 Mi blocks of 4 KiB - the file is sparse, only metadata gets written
+    unlink(defaultPartitionName);
+    bvOptions opts = { 0, 0, NULL, 0, 0, 4096, 4 << 20 };
+    *out << "  bv_init_opts(\"" << defaultPartitionName << "\", blockSize 4096, blockCount 4194304)" << endl;
+    if (bv_init_opts(defaultPartitionName, &opts) != 0)
+      die("bv_init_opts failed on a 16 GiB partition");
+    int fd = OPEN("big.data", BV_WCONCAT);
+    WRITE(fd, inData, sizeof(inData));
+    CLOSE(fd);
+    DESTROY(defaultPartitionName);
+
+    struct stat st;
+    if (stat(defaultPartitionName, &st) != 0 || st.st_size != 4096LL * (4 << 20))
+      die("partition file isn't 16 GiB");
+
+    bvOptions mapped = { BV_MMAP, 0, NULL, 0, 0, 0, 0 };
+    for(int mode=0; mode < 2; mode++) {
+      *out << "  bv_init_opts(\"" << defaultPartitionName << "\", " << (mode == 0 ? "NULL" : "BV_MMAP") << ")" << endl;
+      if (bv_init_opts(defaultPartitionName, mode == 0 ? NULL : &mapped) != 0)
+        die("bv_init_opts failed mounting a 16 GiB partition");
+      fd = OPEN("big.data", BV_RDONLY);
+      READ(fd, outData, sizeof(outData));
+      CLOSE(fd);
+      if (memcmp(inData, outData, sizeof(inData)) != 0)
+        die("data differs after mounting a 16 GiB partition again");
+      DESTROY(defaultPartitionName);
+    }
+    unlink(defaultPartitionName);
+  },
+
+
+  []() {
+    *out << "[Directories - paths, same names in different places, a B+tree several levels deep]" << endl;
+    INIT(defaultPartitionName);
+    *out << "  bv_mkdir(\"docs\"), bv_mkdir(\"docs/old\"), bv_mkdir(\"many\")" << endl;
+    if (bv_mkdir("docs") != 0 || bv_mkdir("docs/old") != 0 || bv_mkdir("many") != 0)
+      die("bv_mkdir failed");
+
+    const char *paths[] = { "a.txt", "docs/a.txt", "/docs//old/a.txt" };
+    for(int i=0; i < 3; i++) {
+      int fd = OPEN(paths[i], BV_WCONCAT);
+      WRITE(fd, &i, sizeof(i));
+      CLOSE(fd);
+    }
+
+    // Each of these has to fail and say why
+    *out << "  bv_mkdir(\"docs\"), bv_mkdir(\"nope/x\"), bv_open(\"nope/x\"), bv_open(\"docs\"), bv_unlink(\"docs\"), bv_rmdir(\"docs\")" << endl;
+    for(int i=0; i < 6; i++) {
+      redirectOutput();
+      int ret = (i == 0) ? bv_mkdir("docs") : (i == 1) ? bv_mkdir("nope/x") : (i == 2) ? bv_open("nope/x", BV_WCONCAT)
+              : (i == 3) ? bv_open("docs", BV_RDONLY) : (i == 4) ? bv_unlink("docs") : bv_rmdir("docs");
+      string output = restoreOutput();
+      if (ret != -1 || output.size() == 0)
+        die("a bad directory operation didn't fail with a message, case ", to_string(i));
+    }
+
+    // 200 names in shuffled order - 13 entries fit a 512 byte node, so this splits a few levels deep
+    int order[200];
+    for(int i=0; i < 200; i++) order[i] = i;
+    for(int i=199; i > 0; i--) swap(order[i], order[rand() % (i+1)]);
+    char name[64];
+    *out << "  200 x bv_open(\"many/fNNN\", BV_WCONCAT), bv_write, bv_close" << endl;
+    for(int i=0; i < 200; i++) {
+      sprintf(name, "many/f%03d", order[i]);
+      int fd = bv_open(name, BV_WCONCAT);
+      if (fd < 0 || bv_write(fd, &order[i], sizeof(int)) != sizeof(int) || bv_close(fd) != 0)
+        die("couldn't write ", name);
+    }
+
+    // Listed in name order, under their paths
+    *out << "  bv_ls()" << endl;
+    redirectOutput();
+    bv_ls();
+    string output = restoreOutput();
+    if (output.find("203 Files, 3 Directories") == string::npos)
+      die("bv_ls header should count 203 files and 3 directories: ", output);
+    if (output.find("docs/old/a.txt") == string::npos)
+      die("bv_ls didn't list a nested file: ", output);
+    size_t last = 0;
+    for(int i=0; i < 200; i++) {
+      sprintf(name, "many/f%03d", i);
+      size_t at = output.find(name);
+      if (at == string::npos || at < last)
+        die("bv_ls didn't list the directory in name order at ", name);
+      last = at;
+    }
+    DESTROY(defaultPartitionName);
+
+    RE_INIT(defaultPartitionName);
+    for(int i=0; i < 3; i++) {
+      int fd = OPEN(paths[i], BV_RDONLY), val = -1;
+      READ(fd, &val, sizeof(val));
+      CLOSE(fd);
+      if (val != i)
+        die("wrong contents after destroy/init in ", paths[i]);
+    }
+    *out << "  200 x bv_open(\"many/fNNN\", BV_RDONLY), bv_read, bv_close" << endl;
+    for(int i=0; i < 200; i++) {
+      sprintf(name, "many/f%03d", i);
+      int fd = bv_open(name, BV_RDONLY), val = -1;
+      if (fd < 0 || bv_read(fd, &val, sizeof(val)) != sizeof(val) || val != i)
+        die("wrong contents after destroy/init in ", name);
+      bv_close(fd);
+    }
+
+    // Unlinking empties nodes out of the tree - the rest stay reachable
+    *out << "  bv_unlink the even ones, then the odd ones, then bv_rmdir(\"many\")" << endl;
+    for(int pass=0; pass < 2; pass++) {
+      for(int i=pass; i < 200; i += 2) {
+        sprintf(name, "many/f%03d", i);
+        if (bv_unlink(name) != 0)
+          die("couldn't unlink ", name);
+      }
+      for(int i=1-pass; pass == 0 && i < 200; i += 2) {
+        sprintf(name, "many/f%03d", i);
+        int fd = bv_open(name, BV_RDONLY);
+        if (fd < 0)
+          die("lost ", name);
+        bv_close(fd);
+      }
+    }
+    if (bv_rmdir("many") != 0)
+      die("couldn't remove the emptied directory");
+    for(int i=2; i >= 0; i--) {
+      if (bv_unlink(paths[i]) != 0)
+        die("couldn't unlink ", paths[i]);
+    }
+    if (bv_rmdir("docs/old") != 0 || bv_rmdir("docs") != 0)
+      die("couldn't remove the nested directories");
+    DESTROY(defaultPartitionName);
+
+    // Nothing is left but the root directory's node
+    RE_INIT(defaultPartitionName);
+    redirectOutput();
+    bv_ls();
+    output = restoreOutput();
+    if (output.find("0 Files") == string::npos || output.find("Director") != string::npos)
+      die("bv_ls should be empty again: ", output);
+    static char fill[(16384 - 199 - 1) * 512];
+    int fd = OPEN("fill.data", BV_WCONCAT);
+    *out << "  bv_write(fd, buf, " << sizeof(fill) << ")" << endl;
+    if (bv_write(fd, fill, sizeof(fill)) != (int)sizeof(fill))
+      die("directory blocks weren't given back");
+    CLOSE(fd);
+    DESTROY(defaultPartitionName);
+    unlink(defaultPartitionName);
+  },
+
+
+  []() {
+    *out << "[Tiny files live in their iNode - no blocks, spill to a block as they grow, back after BV_WTRUNC, replayed from the journal]" << endl;
+    char name[32];
+    INIT(defaultPartitionName);
+    for(int i=0; i < 10; i++) {
+      sprintf(name, "tiny%d", i);
+      int fd = OPEN(name, BV_WCONCAT);
+      WRITE(fd, &i, sizeof(i));
+      CLOSE(fd);
+    }
+
+    // Grows a little at a time - still inline at 90 bytes, a block at 200
+    char grown[200], back[200];
+    for(int i=0; i < 200; i++) grown[i] = (char)(i * 7 + 1);
+    int fd = OPEN("grows", BV_WCONCAT);
+    WRITE(fd, grown, 90);
+    *out << "  bv_fsync(fd)" << endl;
+    bv_fsync(fd);
+    redirectOutput();
+    bv_ls();
+    string output = restoreOutput();
+    if (output.find("bytes: 4, blocks: 0,") == string::npos || output.find("bytes: 90, blocks: 0,") == string::npos)
+      die("tiny files shouldn't take any blocks: ", output);
+    WRITE(fd, grown + 90, 110);
+    CLOSE(fd);
+    redirectOutput();
+    bv_ls();
+    output = restoreOutput();
+    if (output.find("bytes: 200, blocks: 1,") == string::npos)
+      die("a file past the inline size should have a block: ", output);
+    fd = OPEN("grows", BV_RDONLY);
+    READ(fd, back, 200);
+    CLOSE(fd);
+    if (memcmp(grown, back, 200) != 0)
+      die("bytes moved out of the iNode came back different");
+
+    // A write past the end of an inline file leaves zeros
+    fd = OPEN("gap", BV_RDWR);
+    *out << "  bv_pwrite(fd, \"xy\", 2, 50)" << endl;
+    if (bv_pwrite(fd, "xy", 2, 50) != 2)
+      die("bv_pwrite into an inline file failed");
+    CLOSE(fd);
+
+    // BV_WTRUNC gives the block back and the file is inline again
+    fd = OPEN("grows", BV_WTRUNC);
+    WRITE(fd, (void*)"small", 5);
+    CLOSE(fd);
+
+    // Mount again without bv_destroy - inline bytes come back with their iNode from the journal
+    RE_INIT(defaultPartitionName);
+    for(int i=0; i < 10; i++) {
+      int num = -1;
+      sprintf(name, "tiny%d", i);
+      fd = OPEN(name, BV_RDONLY);
+      READ(fd, &num, sizeof(num));
+      CLOSE(fd);
+      if (num != i)
+        die("wrong contents in inline file ", name);
+    }
+    fd = OPEN("grows", BV_RDONLY);
+    if (bv_read(fd, back, 200) != 5 || memcmp(back, "small", 5) != 0)
+      die("truncated file didn't come back as \"small\"");
+    CLOSE(fd);
+    fd = OPEN("gap", BV_RDONLY);
+    if (bv_read(fd, back, 200) != 52 || back[0] != 0 || back[49] != 0 || memcmp(back + 50, "xy", 2) != 0)
+      die("the gap in an inline file didn't read back as zeros");
+    CLOSE(fd);
+
+    // Every block but the root directory's node is still free
+    static char fill[(16384 - 199 - 1) * 512];
+    fd = OPEN("fill.data", BV_WCONCAT);
+    *out << "  bv_write(fd, buf, " << sizeof(fill) << ")" << endl;
+    if (bv_write(fd, fill, sizeof(fill)) != (int)sizeof(fill))
+      die("inline files are holding blocks");
+    CLOSE(fd);
+    DESTROY(defaultPartitionName);
+
+    // A view of an inline file is a copy - a write to the iNode doesn't show through it
+    bvOptions mapped = { BV_MMAP, 0, NULL, 0, 0, 0, 0 };
+    *out << "  bv_init_opts(\"" << defaultPartitionName << "\", BV_MMAP)" << endl;
+    if (bv_init_opts(defaultPartitionName, &mapped) != 0)
+      die("bv_init_opts failed to map the partition");
+    fd = OPEN("tiny3", BV_RDONLY);
+    bvSpan span;
+    *out << "  bv_read_view(fd, 4, spans, 1)" << endl;
+    if (bv_read_view(fd, 4, &span, 1) != 1 || span.len != 4 || *(const int*)span.data != 3)
+      die("bv_read_view of an inline file");
+    int other = OPEN("tiny3", BV_RDWR);
+    int changed = 99;
+    *out << "  bv_pwrite(other, &changed, 4, 0)" << endl;
+    if (bv_pwrite(other, &changed, 4, 0) != 4)
+      die("bv_pwrite over a viewed inline file failed");
+    CLOSE(other);
+    if (*(const int*)span.data != 3)
+      die("a view of an inline file changed under its reader");
+    *out << "  bv_lseek(fd, 0, BV_SEEK_SET), bv_read_view(fd, 4, spans, 1)" << endl;
+    bv_lseek(fd, 0, BV_SEEK_SET);
+    if (bv_read_view(fd, 4, &span, 1) != 0)
+      die("a second view of an inline file overwrote the first");
+    bv_release_view(fd);
+    if (bv_read_view(fd, 4, &span, 1) != 1 || *(const int*)span.data != 99)
+      die("bv_read_view after bv_release_view");
+    CLOSE(fd);
+    DESTROY(defaultPartitionName);
+    unlink(defaultPartitionName);
+  },
+
+
+  []() {
+    *out << "[bv_stat and bv_readdir - structured entries in name order, a batch at a time, resumed from a cursor]" << endl;
+    char name[64];
+    char bytes[300] = {0};
+    INIT(defaultPartitionName);
+    *out << "  bv_mkdir(\"lots\")" << endl;
+    if (bv_mkdir("lots") != 0)
+      die("bv_mkdir failed");
+    // Enough names for the directory's tree to need a few levels - sizes either side of inline
+    for(int i=0; i < 300; i++) {
+      sprintf(name, "lots/f%03d", i);
+      int fd = OPEN(name, BV_WCONCAT);
+      WRITE(fd, bytes, i);
+      CLOSE(fd);
+    }
+    int fd = OPEN("top", BV_WCONCAT);
+    WRITE(fd, bytes, 10);
+    CLOSE(fd);
+
+    bvStat st;
+    *out << "  bv_stat(\"lots/f150\", &st)" << endl;
+    if (bv_stat("lots/f150", &st) != 0 || strcmp(st.name, "f150") != 0 || st.size != 150 || st.blocks != 1 || st.isDir)
+      die("bv_stat of a file gave the wrong answer");
+    *out << "  bv_stat(\"lots\", &st)" << endl;
+    if (bv_stat("lots", &st) != 0 || !st.isDir || st.blocks < 2)
+      die("bv_stat of a directory gave the wrong answer");
+    *out << "  bv_stat(\"/\", &st)" << endl;
+    if (bv_stat("/", &st) != 0 || strcmp(st.name, "/") != 0 || !st.isDir || st.blocks < 1)
+      die("bv_stat of the root gave the wrong answer");
+    redirectOutput();
+    int ret = bv_stat("lots/nope", &st);
+    restoreOutput();
+    if (ret != -1)
+      die("bv_stat found a file that doesn't exist");
+
+    // The root holds the directory and top, in name order
+    bvDirCursor cursor = {};
+    bvStat ents[7];
+    *out << "  bv_readdir(\"/\", &cursor, ents, 7)" << endl;
+    if (bv_readdir("/", &cursor, ents, 7) != 2 || strcmp(ents[0].name, "lots") != 0 || !ents[0].isDir
+        || strcmp(ents[1].name, "top") != 0 || ents[1].size != 10 || ents[1].blocks != 0)
+      die("bv_readdir of the root gave the wrong entries");
+    if (bv_readdir("/", &cursor, ents, 7) != 0)
+      die("bv_readdir went on past the end of the root");
+
+    // Seven at a time - f100 goes before it's reached and a name past the cursor shows up
+    bvDirCursor lots = {};
+    int seen = 0, got, expect = 0;
+    *out << "  bv_readdir(\"lots\", &cursor, ents, 7) until it returns 0" << endl;
+    while((got = bv_readdir("lots", &lots, ents, 7)) > 0) {
+      for(int k=0; k < got; k++) {
+        if (expect == 100)
+          expect++;
+        sprintf(name, (expect < 300) ? "f%03d" : "zz", expect);
+        int size = (expect < 300) ? expect : 3;
+        int blocks = (size <= 96) ? 0 : (size + 511) / 512;
+        if (strcmp(ents[k].name, name) != 0 || ents[k].size != size || ents[k].blocks != blocks || ents[k].isDir)
+          die("bv_readdir gave the wrong entry, expected ", name);
+        expect++;
+        seen++;
+      }
+      if (seen == 49) {
+        if (bv_unlink("lots/f100") != 0)
+          die("bv_unlink failed in the middle of a listing");
+        fd = OPEN("lots/zz", BV_WCONCAT);
+        WRITE(fd, bytes, 3);
+        CLOSE(fd);
+        fd = OPEN("lots/a", BV_WCONCAT);
+        CLOSE(fd);
+      }
+    }
+    if (got != 0 || seen != 300)
+      die("bv_readdir didn't list every name exactly once: ", to_string(seen));
+
+    redirectOutput();
+    ret = bv_readdir("top", &cursor, ents, 7);
+    restoreOutput();
+    if (ret != -1)
+      die("bv_readdir listed a file as a directory");
+
+    // A directory keeps the spare nodes it grew into across a destroy
+    bvStat before;
+    bv_stat("lots", &before);
+    DESTROY(defaultPartitionName);
+    RE_INIT(defaultPartitionName);
+    *out << "  bv_stat(\"lots\", &st)" << endl;
+    if (bv_stat("lots", &st) != 0 || st.blocks != before.blocks)
+      die("bv_destroy trimmed a directory's nodes: ", to_string(before.blocks) + " -> " + to_string(st.blocks));
+    DESTROY(defaultPartitionName);
+    unlink(defaultPartitionName);
+  },
+
+
+  []() {
+    *out << "[BV_MMAP: uncommitted iNode and bitmap changes stay off their home blocks, init without destroy rolls back to the last commit]" << endl;
+    static char data[20000], back[20000];
+    for(int i=0; i < 20000; i++) data[i] = (char)rand();
+    unlink(defaultPartitionName);
+    bvOptions mapped = { BV_MMAP, 0, NULL, 0, 0, 0, 0 };
+    *out << "  bv_init_opts(\"" << defaultPartitionName << "\", BV_MMAP)" << endl;
+    if (bv_init_opts(defaultPartitionName, &mapped) != 0)
+      die("bv_init_opts failed to map the partition");
+    // iNode 1 is committed at 1000 bytes by bv_close
+    int fd = OPEN("mapped.data", BV_WCONCAT);
+    WRITE(fd, data, 1000);
+    CLOSE(fd);
+    // ...then grows to 20000 without a commit
+    fd = OPEN("mapped.data", BV_WCONCAT);
+    WRITE(fd, data + 1000, 19000);
+
+    // What the partition holds for iNode 1 and the bitmap must not have the growth yet
+    int host = open(defaultPartitionName, O_RDONLY);
+    int numBytes = 0;
+    unsigned int bitmap[64];
+    *out << "  pread(iNode 1), pread(bitmap)" << endl;
+    if (pread(host, &numBytes, sizeof(numBytes), 512 + 128) != sizeof(numBytes) ||
+        pread(host, bitmap, sizeof(bitmap), 67 * 512) != sizeof(bitmap))
+      die("couldn't read the partition back");
+    close(host);
+    if (numBytes == 20000)
+      die("an uncommitted iNode reached its home block through the mapping");
+    for(int b=199 + 3; b < 64 * 32; b++) {
+      if (bitmap[b / 32] & (1u << (b % 32)))
+        die("an uncommitted allocation reached the bitmap through the mapping, block ", to_string(b));
+    }
+
+    // Crash - mount again without bv_destroy or bv_close
+    *out << "  bv_init_opts(\"" << defaultPartitionName << "\", BV_MMAP)" << endl;
+    if (bv_init_opts(defaultPartitionName, &mapped) != 0)
+      die("bv_init_opts failed to map the partition again");
+    fd = OPEN("mapped.data", BV_RDONLY);
+    *out << "  bv_read(fd, buf, 20000)" << endl;
+    if (bv_read(fd, back, 20000) != 1000 || memcmp(back, data, 1000) != 0)
+      die("the file didn't come back as its last commit");
+    CLOSE(fd);
+    // The growth's blocks are free again - everything but the root node and the 2 committed blocks
+    static char fill[(16384 - 199 - 3) * 512];
+    fd = OPEN("fill.data", BV_WCONCAT);
+    *out << "  bv_write(fd, buf, " << sizeof(fill) << ")" << endl;
+    if (bv_write(fd, fill, sizeof(fill)) != (int)sizeof(fill))
+      die("blocks of the uncommitted growth are still marked used");
+    CLOSE(fd);
+    DESTROY(defaultPartitionName);
+    unlink(defaultPartitionName);
+  },
+
+
+  []() {
+    *out << "[Async writes only grow the file once they finish - bv_close and bv_unlink wait for writes in flight]" << endl;
+    static char first[65536], second[65536], other[65536], back[131072];
+    for(int i=0; i < 65536; i++) {
+      first[i] = (char)rand();
+      second[i] = (char)rand();
+      other[i] = (char)rand();
+    }
+    unlink(defaultPartitionName);
+    bvOptions ring = { BV_URING, 0, NULL, 0, 0, 0, 0 };
+    *out << "  bv_init_opts(\"" << defaultPartitionName << "\", BV_URING)" << endl;
+    if (bv_init_opts(defaultPartitionName, &ring) != 0)
+      die("bv_init_opts failed");
+    int fd = OPEN("async.data", BV_WCONCAT);
+    *out << "  bv_write_async(fd, buf, 65536, tag)" << endl;
+    if (bv_write_async(fd, first, sizeof(first), (void*)1) != 0)
+      die("bv_write_async failed");
+    bvStat st;
+    if (bv_stat("async.data", &st) != 0 || st.size != 0)
+      die("the file grew before the async write was reaped: ", to_string(st.size));
+    bvCompletion done;
+    *out << "  bv_reap(done, 1, 1)" << endl;
+    if (bv_reap(&done, 1, 1) != 1 || done.result != (int)sizeof(first))
+      die("bv_reap didn't hand back the write");
+    if (bv_stat("async.data", &st) != 0 || st.size != 65536)
+      die("the file didn't grow once the async write was reaped: ", to_string(st.size));
+
+    // Closed with a write in flight - bv_close puts it on the file rather than trimming its blocks
+    *out << "  bv_write_async(fd, buf, 65536, tag)" << endl;
+    if (bv_write_async(fd, second, sizeof(second), (void*)2) != 0)
+      die("bv_write_async failed");
+    CLOSE(fd);
+    if (bv_stat("async.data", &st) != 0 || st.size != 131072)
+      die("bv_close didn't wait for the async write: ", to_string(st.size));
+    fd = OPEN("async.data", BV_RDONLY);
+    READ(fd, back, sizeof(back));
+    CLOSE(fd);
+    if (memcmp(back, first, 65536) != 0 || memcmp(back + 65536, second, 65536) != 0)
+      die("async writes read back different");
+
+    // Unlinked with a write in flight - its blocks only go to the next file once it has landed
+    fd = OPEN("gone.data", BV_WCONCAT);
+    *out << "  bv_write_async(fd, buf, 65536, tag)" << endl;
+    if (bv_write_async(fd, first, sizeof(first), (void*)3) != 0)
+      die("bv_write_async failed");
+    CLOSE(fd);
+    *out << "  bv_unlink(\"gone.data\")" << endl;
+    if (bv_unlink("gone.data") != 0)
+      die("bv_unlink failed");
+    fd = OPEN("next.data", BV_WCONCAT);
+    WRITE(fd, other, sizeof(other));
+    CLOSE(fd);
+    bvCompletion all[2];
+    *out << "  bv_reap(done, 2, 2)" << endl;
+    if (bv_reap(all, 2, 2) != 2 || all[0].result != 65536 || all[1].result != 65536)
+      die("bv_reap didn't hand back both writes");
+    fd = OPEN("next.data", BV_RDONLY);
+    READ(fd, back, sizeof(other));
+    CLOSE(fd);
+    if (memcmp(back, other, sizeof(other)) != 0)
+      die("a late async write landed in another file's blocks");
+
+    // Read while the write is in flight - the old bytes it cached can't outlive the write
+    char fresh[512], patched[512];
+    memset(fresh, 'B', sizeof(fresh));
+    fd = OPEN("async.data", BV_RDWR);
+    *out << "  bv_write_async(fd, buf, 512, tag), bv_pread(fd, buf, 512, 0)" << endl;
+    if (bv_write_async(fd, fresh, sizeof(fresh), (void*)4) != 0)
+      die("bv_write_async failed");
+    if (bv_pread(fd, back, sizeof(fresh), 0) != (int)sizeof(fresh))
+      die("bv_pread with a write in flight came up short");
+    *out << "  bv_reap(done, 1, 1), bv_pread(fd, buf, 512, 0)" << endl;
+    if (bv_reap(&done, 1, 1) != 1 || done.result != (int)sizeof(fresh))
+      die("bv_reap didn't hand back the write");
+    if (bv_pread(fd, back, sizeof(fresh), 0) != (int)sizeof(fresh) || memcmp(back, fresh, sizeof(fresh)) != 0)
+      die("a read after bv_reap saw what was there before the async write");
+    *out << "  bv_pwrite(fd, \"xx\", 2, 100)" << endl;
+    if (bv_pwrite(fd, "xx", 2, 100) != 2)
+      die("bv_pwrite failed");
+    CLOSE(fd);
+    DESTROY(defaultPartitionName);
+
+    *out << "  bv_init_opts(\"" << defaultPartitionName << "\", BV_URING)" << endl;
+    if (bv_init_opts(defaultPartitionName, &ring) != 0)
+      die("bv_init_opts failed");
+    memcpy(patched, fresh, sizeof(fresh));
+    memcpy(patched + 100, "xx", 2);
+    fd = OPEN("async.data", BV_RDONLY);
+    READ(fd, back, sizeof(patched));
+    CLOSE(fd);
+    if (memcmp(back, patched, sizeof(patched)) != 0)
+      die("a stale cached block was written over the async write");
+    DESTROY(defaultPartitionName);
+    unlink(defaultPartitionName);
+  },
+
+
+  []() {
+    *out << "[A crash part way through a checkpoint - home never gets ahead of the journal, no block belongs to two files]" << endl;
+    static char old[5000], fresh[5000], back[5000];
+    memset(old, 'a', sizeof(old));
+    memset(fresh, 'b', sizeof(fresh));
+    INIT(defaultPartitionName);
+    int fd = OPEN("f.data", BV_WCONCAT);
+    WRITE(fd, old, sizeof(old));
+    CLOSE(fd);
+
+    // Not committed yet - f gives its blocks back and g takes them
+    OPEN("f.data", BV_WTRUNC);
+    int g = OPEN("g.data", BV_WCONCAT);
+    WRITE(g, fresh, sizeof(fresh));
+
+    // The metadata goes home, then the checkpoint dies before the journal starts over
+    *out << "  fork(): checkpointHome(0), _exit(0)" << endl;
+    pid_t child = fork();
+    if (child == 0) {
+      checkpointHome(0);
+      _exit(0);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    if (!WIFEXITED(status))
+      die("the checkpoint crashed for real");
+
+    RE_INIT(defaultPartitionName);
+    bvStat st;
+    if (bv_stat("f.data", &st) != 0 || st.size != 0)
+      die("the truncate wasn't replayed over the older commit: ", to_string(st.size));
+    fd = OPEN("g.data", BV_RDONLY);
+    READ(fd, back, sizeof(back));
+    CLOSE(fd);
+    if (memcmp(back, fresh, sizeof(fresh)) != 0)
+      die("g didn't come back from the checkpoint");
+
+    // Everything but g's 10 blocks and the root directory's node is free - and only that
+    static char fill[(16384 - 199 - 10 - 1) * 512];
+    fd = OPEN("fill.data", BV_WCONCAT);
+    *out << "  bv_write(fd, buf, " << sizeof(fill) << ")" << endl;
+    if (bv_write(fd, fill, sizeof(fill)) != (int)sizeof(fill))
+      die("the bitmap holds blocks no file has");
+    CLOSE(fd);
+    fd = OPEN("g.data", BV_RDONLY);
+    READ(fd, back, sizeof(back));
+    CLOSE(fd);
+    if (memcmp(back, fresh, sizeof(fresh)) != 0)
+      die("a block g holds was free in the bitmap and went to another file");
+    DESTROY(defaultPartitionName);
+    unlink(defaultPartitionName);
+  },
 };
 
 int main(int argc, char** argv) {